@@ -60,11 +60,24 @@ export class InterfaceDescriptor {
 }
 
 export class CBackend implements backend.Backend {
-    constructor(pkg: Package) {
+    /**
+     * @param component is the package whose config applies, i.e. the main package.
+     * Its config selects the stack size of coroutines and the object header.
+     * @param unity is true if the C files of all packages are compiled as one translation unit.
+     * In this case all functions except for `main` are static.
+     * @param forceBoundsChecks keeps bounds checks which the optimizer proves to be redundant.
+     */
+    constructor(pkg: Package, component: Package | null = null, unity: boolean = false, forceBoundsChecks: boolean = false) {
         this.pkg = pkg;
+        this.biasedRC = !!component && component.biasedRC;
+        this.stackSize = component ? component.stackSize : 0;
+        this.unity = unity;
+        this.forceBoundsChecks = forceBoundsChecks;
         this.optimizer = new Optimizer();
         this.stackifier = new Stackifier();
         this.module = new CModule();
+        // Strings of different packages must not clash, even if the packages have been generated by different runs of the compiler
+        this.module.namePrefix = this.mangleName(pkg.pkgPath ? pkg.pkgPath : pkg.objFileName);
         this.operatorMap.set("mul", "*");
         this.operatorMap.set("add", "+");
         this.operatorMap.set("sub", "-");
@@ -134,6 +147,9 @@ export class CBackend implements backend.Backend {
         } else {
             f.name = this.mangleName((from as Package).pkgPath + "/" + name);
         }
+        if (from instanceof Package) {
+            f.pkg = from;
+        }
         f.index = this.funcs.length;
         this.funcs.push(f);
         return f;
@@ -198,6 +214,7 @@ export class CBackend implements backend.Backend {
             throw new ImplementationError()
         }
         f.func.isPossibleDuplicate = isPossibleDuplicate;
+        f.func.isStatic = this.unity;
         let name = f.name;
         if (!isPossibleDuplicate) {
             if (this.pkg.pkgPath) {
@@ -253,7 +270,8 @@ export class CBackend implements backend.Backend {
         this.module.includes.push(i);
         i = new CInclude();
         i.isSystemPath = false;
-        i.path = "fyr.h";
+        // Includes fyr.h and the inline fast paths of the runtime functions
+        i.path = "fyr_inline.h";
         this.module.includes.push(i);
 
         // Include the header files of all packages that need to run their initializer or that contain possibly duplicated code.
@@ -290,6 +308,38 @@ export class CBackend implements backend.Backend {
             }
         }
 
+        // Small functions of this package and exported functions of imported packages are inlined.
+        // This happens before any function is optimized, because the optimizer modifies the inlined bodies.
+        let bodies = new Map<number, Node>();
+        for(let f of this.funcs) {
+            if (f instanceof FunctionImport) {
+                if (f.pkg && f.pkg.inlineBodies.has(f.name)) {
+                    bodies.set(f.index, f.pkg.inlineBodies.get(f.name));
+                }
+                continue;
+            }
+            if (f.node && this.optimizer.isInlinable(f.node, this.globalVariables)) {
+                bodies.set(f.index, f.node);
+            }
+            // Packages importing this package can inline its small exported functions
+            if (f.isExported && f.node && this.optimizer.isInlinable(f.node, null)) {
+                this.pkg.inlineBodies.set(f.func.name, this.optimizer.copyFunction(f.node));
+            }
+        }
+        for(let f of this.funcs) {
+            if (f instanceof Function && f.node) {
+                this.optimizer.inlineCalls(f.node, bodies);
+            }
+        }
+        if (emitIR) {
+            ircode += '============ OPTIMIZED Inlining ===============\n';
+            for(let f of this.funcs) {
+                if (f instanceof Function && f.node) {
+                    ircode += Node.strainToString("", f.node) + "\n";
+                }
+            }
+        }
+
         for(let f of this.funcs) {
             if (f instanceof FunctionImport) {
                 continue;
@@ -305,12 +355,45 @@ export class CBackend implements backend.Backend {
                 ircode += Node.strainToString("", f.node) + "\n";
             }
 
+            if (!this.forceBoundsChecks) {
+                this.optimizer.removeBoundsChecks(f.node, this.globalVariables);
+                if (emitIR) {
+                    ircode += '============ OPTIMIZED Bounds checks ===============\n';
+                    ircode += Node.strainToString("", f.node) + "\n";
+                }
+            }
+
+            // Reused loads let the null check of the first load cover the others
+            this.optimizer.eliminateCommonSubexpressions(f.node, this.globalVariables);
+            if (emitIR) {
+                ircode += '============ OPTIMIZED Common subexpressions ===============\n';
+                ircode += Node.strainToString("", f.node) + "\n";
+            }
+
+            this.optimizer.removeNullChecks(f.node, this.globalVariables);
+            if (emitIR) {
+                ircode += '============ OPTIMIZED Null checks ===============\n';
+                ircode += Node.strainToString("", f.node) + "\n";
+            }
+
             this.optimizer.removeDeadCode(f.node);
             if (emitIR) {
                 ircode += '============ OPTIMIZED Dead code ===============\n';
                 ircode += Node.strainToString("", f.node) + "\n";
             }
 
+            this.optimizer.removeRedundantRefCounting(f.node);
+            if (emitIR) {
+                ircode += '============ OPTIMIZED Reference counting ===============\n';
+                ircode += Node.strainToString("", f.node) + "\n";
+            }
+
+            this.optimizer.allocateOnStack(f.node);
+            if (emitIR) {
+                ircode += '============ OPTIMIZED Stack allocation ===============\n';
+                ircode += Node.strainToString("", f.node) + "\n";
+            }
+
             this.currentFunction = f;
             this.returnVariables = [];
             this.localVariables = [];
@@ -553,7 +636,12 @@ export class CBackend implements backend.Backend {
             if (t instanceof ssa.FunctionType) {
                 throw new ImplementationError()
             }
+            // The same header as a heap object, see fyr_init_header
             let s = new ssa.StructType()
+            if (this.biasedRC) {
+                s.addField("brc_owner", "i32");
+                s.addField("brc_shared", "s32");
+            }
             s.addField("word1", "sint");
             s.addField("word2", "sint");
             s.addField("value", t);
@@ -684,6 +772,16 @@ export class CBackend implements backend.Backend {
         throw new ImplementationError()
     }
 
+    /**
+     * Returns the type of the value computed by 'n'. For calls this is the result type of the function.
+     */
+    private valueType(n: ssa.Node | ssa.Variable): ssa.Type | ssa.StructType | ssa.PointerType | ssa.FunctionType {
+        if (n instanceof ssa.Node && n.type instanceof FunctionType) {
+            return n.type.result;
+        }
+        return n.type;
+    }
+
     private isSignedType(t: ssa.Type | ssa.StructType | ssa.PointerType | ssa.FunctionType): boolean {
         return t == "s8" || t == "s16" || t == "s32" || t == "s64" || t == "sint";
     }
@@ -707,9 +805,9 @@ export class CBackend implements backend.Backend {
         if (typeof(n) == "string") {
             let s: CString;
             if (this.currentCFunction) {
-                s = this.currentCFunction.addString(n);
+                s = this.currentCFunction.addString(n, this.module.namePrefix);
             } else {
-                s = this.module.addString(n);
+                s = this.module.addString(n, this.module.namePrefix);
             }
             let addr = new CUnary();
             addr.operator = "&";
@@ -1200,17 +1298,17 @@ export class CBackend implements backend.Backend {
             e.operator = this.operatorMap.get(n.kind);
             e.lExpr = this.emitExpr(n.args[0]);
             let a = n.args[0];
-            if ((a instanceof Node || a instanceof Variable) && !this.isSignedType(a.type)) {
+            if ((a instanceof Node || a instanceof Variable) && !this.isSignedType(this.valueType(a))) {
                 let t = new CTypeCast();
-                t.type = this.mapToSignedType(a.type);
+                t.type = this.mapToSignedType(this.valueType(a));
                 t.expr = e.lExpr;
                 e.lExpr = t;
             }
             e.rExpr = this.emitExpr(n.args[1]);
             a = n.args[1];
-            if ((a instanceof Node || a instanceof Variable) && !this.isSignedType(a.type)) {
+            if ((a instanceof Node || a instanceof Variable) && !this.isSignedType(this.valueType(a))) {
                 let t = new CTypeCast();
-                t.type = this.mapToSignedType(a.type);
+                t.type = this.mapToSignedType(this.valueType(a));
                 t.expr = e.rExpr;
                 e.rExpr = t;
             }
@@ -1223,17 +1321,17 @@ export class CBackend implements backend.Backend {
             e.operator = this.operatorMap.get(n.kind);
             e.lExpr = this.emitExpr(n.args[0]);
             let a = n.args[0];
-            if ((a instanceof Node || a instanceof Variable) && this.isSignedType(a.type)) {
+            if ((a instanceof Node || a instanceof Variable) && this.isSignedType(this.valueType(a))) {
                 let t = new CTypeCast();
-                t.type = this.mapToUnsignedType(a.type);
+                t.type = this.mapToUnsignedType(this.valueType(a));
                 t.expr = e.lExpr;
                 e.lExpr = t;
             }
             e.rExpr = this.emitExpr(n.args[1]);
             a = n.args[1];
-            if ((a instanceof Node || a instanceof Variable) && this.isSignedType(a.type)) {
+            if ((a instanceof Node || a instanceof Variable) && this.isSignedType(this.valueType(a))) {
                 let t = new CTypeCast();
-                t.type = this.mapToUnsignedType(a.type);
+                t.type = this.mapToUnsignedType(this.valueType(a));
                 t.expr = e.rExpr;
                 e.rExpr = t;
             }
@@ -1351,6 +1449,11 @@ export class CBackend implements backend.Backend {
             m.funcExpr = new CConst("fyr_alloc_arr");
             m.args = [this.emitExpr(n.args[0]), this.emitExpr(n.args[1])];
             return m;
+        } else if (n.kind == "alloc_str") {
+            let m = new CFunctionCall();
+            m.funcExpr = new CConst("fyr_alloc_str");
+            m.args = [this.emitExpr(n.args[0])];
+            return m;
         } else if (n.kind == "free_arr") {
             let m = new CFunctionCall();
             m.funcExpr = new CConst("fyr_free_arr");
@@ -1433,6 +1536,11 @@ export class CBackend implements backend.Backend {
             call.args = [this.emitExpr(n.args[0]), this.emitExpr(n.args[1]), this.emitExpr(n.args[2])];
             this.includeStringHeaderFile();
             return call;
+        } else if (n.kind == "eq_str") {
+            let call = new CFunctionCall();
+            call.funcExpr = new CConst("fyr_eq_str");
+            call.args = [this.emitExpr(n.args[0]), this.emitExpr(n.args[1])];
+            return call;
         } else if (n.kind == "table_iface") {
             let idx = n.args[0];
             if (typeof(idx) != "number") {
@@ -1548,12 +1656,6 @@ export class CBackend implements backend.Backend {
             inc.path = "fyr_spawn.h";
             this.module.includes.push(inc);
         }
-        if (!this.module.hasInclude("alloca.h", true)) {
-            let inc = new CInclude();
-            inc.isSystemPath = true;
-            inc.path = "alloca.h";
-            this.module.includes.push(inc);
-        }
     }
 
     private includePackageHeaderFile(p: Package) {
@@ -1701,9 +1803,9 @@ export class CBackend implements backend.Backend {
                     let p = new CFunctionParameter();
                     p.name = "p" + i.toString();
                     if (argList == "") {
-                        argList = p.name;
+                        argList = "a->" + p.name;
                     } else {
-                        argList += ", " + p.name;
+                        argList += ", a->" + p.name;
                     }
                     if (f instanceof FunctionImport) {
                         let ctype = this.mapType(n.type.params[i-1], true);
@@ -1741,32 +1843,25 @@ export class CBackend implements backend.Backend {
                 }
                 result = c;
 
+                // The arguments are stored behind the fyr_coro_t of the new coroutine.
+                // Both functions declare the same struct for accessing them.
+                let argStruct = "struct spawn_args_" + tc + " { " + params.map(function(c: CFunctionParameter) { return c.toString() + "; "}).join("") + "} *a";
+                let argAccess = "a = (struct spawn_args_" + tc + "*)(c + 1)";
+
+                // The function executed by the new coroutine
                 let f2 = new CFunction();
                 f2.name = name2;
                 f2.returnType = new CType("void");
-                let params2: Array<CFunctionParameter> = [];
                 let p = new CFunctionParameter();
-                p.name = "dummy";
-                p.type = new CType("__attribute__ ((unused)) void *");
-                params2.push(p);
-                p = new CFunctionParameter();
-                p.name = "caller";
-                p.type = new CType("jmp_buf");
-                params2.push(p);
-                p = new CFunctionParameter();
                 p.name = "c";
                 p.type = new CType("struct fyr_coro_t*");
-                params2.push(p);
-                params2 = params2.concat(params);
-                f2.parameters = params2;
+                f2.parameters = [p];
                 f2.isPossibleDuplicate = true;
                 f2.body = [
-                    new CConst("if (!setjmp(c->buf)) { longjmp(caller, 1); }"),
-                    new CConst("fyr_running = c"),
-                    new CConst("fun(" + argList + ")"),
-                    new CConst("fyr_running = NULL"),
-                    new CConst("fyr_garbage_coro = c"),
-                    new CConst("fyr_yield(true)")
+                    new CConst(argStruct),
+                    new CConst(argAccess),
+                    new CConst("a->fun(" + argList + ")"),
+                    new CConst("fyr_exit()")
                 ];
                 this.module.elements.push(f2);
 
@@ -1776,22 +1871,15 @@ export class CBackend implements backend.Backend {
                 f1.parameters = params;
                 f1.isPossibleDuplicate = true;
                 f1.body = [
-                    new CConst("addr_t p; addr_t newtop; addr_t mytop; addr_t dummy"),
+                    new CConst(argStruct),
                     new CConst("struct fyr_coro_t *c"),
-                    new CConst("jmp_buf buf"),
-                    new CConst("p = fyr_alloc(fyr_stacksize())"),
-                    new CConst("c = (struct fyr_coro_t*)p"),
-                    new CConst("newtop = p + fyr_stacksize()"),
-                    new CConst("mytop = (addr_t)&p"),
-                    new CConst("dummy = alloca((size_t)((intptr_t)mytop - (intptr_t)newtop))"),
-                    new CConst("c->memory = dummy"),
-                    new CConst("c->next = fyr_ready_first"),
-                    new CConst("c->memory = p"),
-                    new CConst("fyr_ready_first = c"),
-                    new CConst("if (fyr_ready_last == NULL) { fyr_ready_last = c; }"),
-                    new CConst("if (setjmp(buf)) { return; }"),
-                    new CConst(name2 + "(dummy, buf, c" + (argList != "" ? ", ": "") + argList + ", fun)")
+                    new CConst("c = fyr_coro_new(" + name2 + ", sizeof(struct spawn_args_" + tc + "), " + this.stackSize.toString() + ")"),
+                    new CConst(argAccess)
                 ];
+                for(let p of params) {
+                    f1.body.push(new CConst("a->" + p.name + " = " + p.name));
+                }
+                f1.body.push(new CConst("fyr_spawn(c)"));
                 this.module.elements.push(f1);
 
                 code.push(result);
@@ -2115,6 +2203,10 @@ export class CBackend implements backend.Backend {
     }
 
     private pkg: Package;
+    private biasedRC: boolean;
+    private stackSize: number;
+    private unity: boolean;
+    private forceBoundsChecks: boolean;
     private optimizer: Optimizer;
     private stackifier: Stackifier;
     private module: CModule;
@@ -2254,11 +2346,11 @@ export class CModule {
         return false;
     }
 
-    public addString(str: string): CString {
+    public addString(str: string, prefix: string): CString {
         if (this.strings.has(str)) {
             return this.strings.get(str);
         }
-        let s = new CString(str);
+        let s = new CString(str, prefix);
         this.strings.set(str, s);
         return s;
     }
@@ -2269,6 +2361,8 @@ export class CModule {
     public ifaceDescriptors: Array<InterfaceDescriptor> = [];
     public symbols: Map<string, CConst> = new Map<string, CConst>();
     public isExecutable: boolean;
+    // Prepended to the names of strings
+    public namePrefix: string = "";
 }
 
 export abstract class CNode {
@@ -2293,9 +2387,9 @@ export class CExtern extends CNode {
 }
 
 export class CString extends CNode {
-    constructor(str: string) {
+    constructor(str: string, prefix: string = "") {
         super();
-        this.name = "str_" + CString.counter.toString();
+        this.name = "str_" + prefix + "_" + CString.counter.toString();
         CString.counter++;
         this.bytes = CString.toUTF8Array(str);
         // Add trailing zero for C-compatibility
@@ -2303,7 +2397,7 @@ export class CString extends CNode {
     }
 
     public toString(indent: string = ""): string {
-        let str = indent + "struct {\n" + indent + "    int_t size;\n" + indent + "    int_t lockcount;\n" + indent + "    int_t refcount;\n" + indent + "    uint8_t data[" + this.bytes.length + "];\n" + indent + "} " + this.name + " = {" + this.bytes.length + ", 1, 1";
+        let str = indent + "struct {\n" + indent + "    int_t size;\n" + indent + "    FYR_BRC_FIELDS\n" + indent + "    int_t lockcount;\n" + indent + "    int_t refcount;\n" + indent + "    uint8_t data[" + this.bytes.length + "];\n" + indent + "} " + this.name + " = {" + this.bytes.length + ", FYR_BRC_STATIC 1, 1";
         if (this.bytes.length != 0) {
             str += ",";
         }
@@ -2365,20 +2459,20 @@ export class CFunction extends CNode {
         }
         str += "\n";
 
-        str += indent + this.returnType + " " + this.name + "(" + this.parameters.map(function(c: CFunctionParameter) { return c.toString()}).join(", ") + ") {\n";
+        str += indent + (this.isStatic ? "static " : "") + this.returnType + " " + this.name + "(" + this.parameters.map(function(c: CFunctionParameter) { return c.toString()}).join(", ") + ") {\n";
         str += this.body.map(function(c: CNode) { return c.toString(indent + "    ") + ";"}).join("\n");
         return str + "\n" + indent + "}";
     }
 
     public declaration(): string {
-        return this.returnType + " " + this.name + "(" + this.parameters.map(function(c: CFunctionParameter) { return c.toString()}).join(", ") + ");";
+        return (this.isStatic ? "static " : "") + this.returnType + " " + this.name + "(" + this.parameters.map(function(c: CFunctionParameter) { return c.toString()}).join(", ") + ");";
     }
 
-    public addString(str: string): CString {
+    public addString(str: string, prefix: string): CString {
         if (this.strings.has(str)) {
             return this.strings.get(str);
         }
-        let s = new CString(str);
+        let s = new CString(str, prefix);
         this.strings.set(str, s);
         return s;
     }
@@ -2388,6 +2482,8 @@ export class CFunction extends CNode {
     public parameters: Array<CFunctionParameter> = [];
     public body: Array<CNode> = [];
     public isPossibleDuplicate: boolean;
+    // Set in unity builds, where all packages are compiled as one translation unit
+    public isStatic: boolean;
     public strings: Map<string, CString> = new Map<string, CString>();
 }
 
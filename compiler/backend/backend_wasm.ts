@@ -61,7 +61,11 @@ class Wasm32LocalVariableList {
 }
 
 export class Wasm32Backend implements backend.Backend {
-    constructor() {
+    /**
+     * @param forceBoundsChecks keeps bounds checks which the optimizer proves to be redundant.
+     */
+    constructor(forceBoundsChecks: boolean = false) {
+        this.forceBoundsChecks = forceBoundsChecks;
         this.tr = new SMTransformer();
         this.optimizer = new Optimizer();
         this.stackifier = new Stackifier();
@@ -188,6 +192,23 @@ export class Wasm32Backend implements backend.Backend {
             }
         }
 
+        // Small functions are inlined before any function is optimized, because the optimizer modifies the inlined bodies
+        let bodies = new Map<number, Node>();
+        for(let f of this.funcs) {
+            if (this.optimizer.isInlinable(f.node, this.globalVariables)) {
+                bodies.set(f.wf.getIndex(), f.node);
+            }
+        }
+        for(let f of this.funcs) {
+            this.optimizer.inlineCalls(f.node, bodies);
+        }
+        if (emitIR) {
+            ircode += '============ OPTIMIZED Inlining ===============\n';
+            for(let f of this.funcs) {
+                ircode += Node.strainToString("", f.node) + "\n";
+            }
+        }
+
         // Generate WASM code for all functions
         for(let f of this.funcs) {
             this.optimizer.optimizeConstants(f.node);
@@ -196,6 +217,20 @@ export class Wasm32Backend implements backend.Backend {
                 ircode += Node.strainToString("", f.node) + "\n";
             }
 
+            if (!this.forceBoundsChecks) {
+                this.optimizer.removeBoundsChecks(f.node, this.globalVariables);
+                if (emitIR) {
+                    ircode += '============ OPTIMIZED Bounds checks ===============\n';
+                    ircode += Node.strainToString("", f.node) + "\n";
+                }
+            }
+
+            this.optimizer.eliminateCommonSubexpressions(f.node, this.globalVariables);
+            if (emitIR) {
+                ircode += '============ OPTIMIZED Common subexpressions ===============\n';
+                ircode += Node.strainToString("", f.node) + "\n";
+            }
+
             this.optimizer.removeDeadCode(f.node);
             if (emitIR) {
                 ircode += '============ OPTIMIZED Dead code ===============\n';
@@ -2496,6 +2531,7 @@ export class Wasm32Backend implements backend.Backend {
     public module: wasm.Module;
 
     private tr: SMTransformer;
+    private forceBoundsChecks: boolean;
     private optimizer: Optimizer;
     private stackifier: Stackifier;
     private funcs: Array<{node: Node, wf: wasm.Function, isExported: boolean}>;
@@ -864,8 +864,7 @@ export class CodeGenerator {
                     let l1 = b.assign(b.tmp(), "len_str", "sint", [p1]);
                     let l2 = b.assign(b.tmp(), "len_str", "sint", [p2]);
                     let l = b.assign(b.tmp(), "add", "sint", [l1, l2]);
-                    let lplus = b.assign(b.tmp(), "add", "sint", [l, 1]);
-                    let ptr = b.assign(b.tmp(), "alloc_arr", "addr", [lplus, 1]);
+                    let ptr = b.assign(b.tmp(), "alloc_str", "addr", [l]);
                     b.assign(b.mem, "memcpy", null, [ptr, p1, l1, 1]);
                     let ptr2 = b.assign(b.tmp(), "add", "addr", [ptr, l1]);
                     b.assign(b.mem, "memcpy", null, [ptr2, p2, l2, 1]);
@@ -2328,8 +2327,7 @@ export class CodeGenerator {
                     let p2 = this.processExpression(f, scope, enode.rhs, b, vars, dtor, "none", true);
                     let l2 = b.assign(b.tmp(), "len_str", "sint", [p2]);
                     let l = b.assign(b.tmp(), "add", "sint", [l1, l2]);
-                    let lplus = b.assign(b.tmp(), "add", "sint", [l, 1]);
-                    let ptr = b.assign(b.tmp(), "alloc_arr", "addr", [lplus, 1]);
+                    let ptr = b.assign(b.tmp(), "alloc_str", "addr", [l]);
                     b.assign(b.mem, "memcpy", null, [ptr, p1, l1, 1]);
                     let ptr2 = b.assign(b.tmp(), "add", "addr", [ptr, l1]);
                     b.assign(b.mem, "memcpy", null, [ptr2, p2, l2, 1]);
@@ -3134,17 +3132,14 @@ export class CodeGenerator {
                         b.end();
                     }
                     let ptr3 = b.assign(b.tmp(), "add", "addr", [ptr, index1]);
-                    let l: ssa.Variable | number;
                     let copyLen: ssa.Variable | number;
                     if (typeof(index1) == "number" && typeof(index2) == "number") {
-                        l = index2 - index1 + 1;
                         copyLen = index2 - index1;
                     } else {
                         copyLen = b.assign(b.tmp(), "sub", "sint", [index2, index1]);
-                        l = b.assign(b.tmp(), "add", "sint", [copyLen, 1]);
                     }
-                    // This is allocating one byte more. Optimization: Do not use calloc. But then add a trailing zero!
-                    let result = b.assign(b.tmp(), "alloc_arr", "addr", [l, 1]);
+                    // alloc_str does not zero the memory, except for the trailing zero
+                    let result = b.assign(b.tmp(), "alloc_str", "addr", [copyLen]);
                     b.assign(b.mem, "memcpy", null, [result, ptr3, copyLen, 1]);
                     if (keepAlive != "donate") {
                         dtor.push(new DestructorInstruction(result, Static.t_string, "destruct"));
@@ -3661,9 +3656,8 @@ export class CodeGenerator {
                         let str = b.assign(b.tmp(), "copy", "addr", [0]);
                         let nn = b.assign(b.tmp(), "ne", "i8", [ptr, 0]);
                         b.ifBlock(nn);
-                        // Make room for the terminating 0 character
-                        let l2 = b.assign(b.tmp(), "add", "sint", [l, 1]);
-                        b.assign(str, "alloc_arr", "addr", [l2, 1]);
+                        // alloc_str makes room for the terminating 0 character
+                        b.assign(str, "alloc_str", "addr", [l]);
                         b.assign(b.mem, "memcpy", null, [str, ptr, l, 1]);
                         b.end();
                         // this.processDestructorInstructions(dtor, b);
@@ -4223,7 +4217,15 @@ export class CodeGenerator {
             let dtor: Array<DestructorInstruction> = [];
             let p1 = this.processExpression(f, scope, enode.lhs, b, vars, dtor, "lock");
             let p2 = this.processExpression(f, scope, enode.rhs, b, vars, dtor, "none");
-            // let cond = b.assign(b.tmp(), "eq", "i8", [p1, p2]);
+            if (opcode == "eq" || opcode == "ne") {
+                // Compares the pointers first, then the lengths and only then the bytes
+                let cond = b.assign(b.tmp(), "eq_str", "i8", [p1, p2]);
+                this.processDestructorInstructions(dtor, b);
+                if (opcode == "ne") {
+                    return b.assign(b.tmp(), "eqz", "i8", [cond]);
+                }
+                return cond;
+            }
             let l1 = b.assign(b.tmp(), "len_arr", "sint", [p1]);
             let l2 = b.assign(b.tmp(), "len_arr", "sint", [p2]);
             let l = b.assign(b.tmp(), "min", "sint", [l1, l2])
@@ -5196,6 +5198,7 @@ export class CodeGenerator {
      */
     private loadPackage(pkgPath: string, loc: Location): Package {
         let p = Package.resolve(pkgPath, loc);
+        this.tc.pkg.addImport(p);
         Package.checkTypesForPackages();
         return p;
     }
@@ -10,6 +10,18 @@ export class FyrConfiguration {
     public disableCodegen: boolean = true;
     public disableRuntime: boolean = false;
     public disableNullCheck: boolean = false;
+    // Keep bounds checks which the optimizer proves to be redundant
+    public forceBoundsChecks: boolean = false;
+    // Number of gcc processes running in parallel. Zero means one per CPU.
+    public jobs: number = 0;
+    // Link-time optimization across packages and the runtime
+    public lto: boolean = false;
+    // Directory in which an executable built for profiling writes its profile
+    public pgoGenerate: string = null;
+    // Directory of the profile that guides the optimization
+    public pgoUse: string = null;
+    // Compile the generated code of all packages as one translation unit
+    public unity: boolean = false;
     public fyrPaths: string[];
     public sourcePath: Array<string | object>;
     public errorHandler: ErrorHandler = new StdErrorOutput;
@@ -11,6 +11,14 @@ export interface ErrorHandler {
 }
 
 export class StdErrorOutput implements ErrorHandler {
+    /**
+     * @param exitOnError terminates the process once an error has been reported.
+     * The watch mode reports errors and keeps running.
+     */
+    constructor(exitOnError: boolean = true) {
+        this.exitOnError = exitOnError;
+    }
+
     handle(e: Error) {
         if (e instanceof TypeError) {
             console.log((e.location.file + " (" + e.location.start.line + "," + e.location.start.column + "): ").yellow + e.message.red);
@@ -32,7 +40,9 @@ export class StdErrorOutput implements ErrorHandler {
                 console.error(e)
             }
         }
-        process.exit(1)
+        if (this.exitOnError) {
+            process.exit(1)
+        }
     }
 
     /**
@@ -67,4 +77,6 @@ export class StdErrorOutput implements ErrorHandler {
         }
         return outputLine + '^\n'
     }
+
+    private exitOnError: boolean;
 }
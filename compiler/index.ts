@@ -6,7 +6,8 @@ import program = require('commander');
 import colors = require('colors');
 import { Package } from "./pkg";
 import { FyrConfiguration } from "./config";
-import { ImplementationError } from './errors';
+import { ImplementationError, StdErrorOutput } from './errors';
+import { Watcher } from "./watch";
 
 // Make TSC not throw out the colors lib
 colors.red;
@@ -27,6 +28,30 @@ function runCompiler() {
     config.emitC = program.emitC || program.emitNative;
     config.emitNative = program.emitNative;
     config.emitIr = program.emitIr;
+    if (program.jobs !== undefined) {
+        if (isNaN(program.jobs) || program.jobs < 1) {
+            console.log(("The number of jobs must be a positive integer").red);
+            process.exit(1);
+        }
+        config.jobs = program.jobs;
+    }
+    if ((program.lto || program.pgoGenerate || program.pgoUse) && !program.emitNative) {
+        console.log(("LTO and PGO require a native executable").red);
+        process.exit(1);
+    }
+    if (program.pgoGenerate && program.pgoUse) {
+        console.log(("Only one of --pgo-generate and --pgo-use can be selected").red);
+        process.exit(1);
+    }
+    if (program.unity && !program.emitNative) {
+        console.log(("A unity build requires a native executable").red);
+        process.exit(1);
+    }
+    config.unity = !!program.unity;
+    config.forceBoundsChecks = !!program.forceBoundsChecks;
+    config.lto = !!program.lto;
+    config.pgoGenerate = program.pgoGenerate || null;
+    config.pgoUse = program.pgoUse || null;
 
     var args: Array<object | string> = Array.prototype.slice.call(arguments, 0);
     if (args.length <= 1) {
@@ -48,6 +73,13 @@ function runCompiler() {
 //        files.push(path.join(fyrBase, "runtime/map.fyr"));
 //    }
 
+    if (program.watch) {
+        config.errorHandler = new StdErrorOutput(false);
+        let watcher = new Watcher((changed) => changed ? recompile(changed, config) : compile(pkg, config));
+        watcher.start();
+        return;
+    }
+
     compile(pkg, config);
 }
 
@@ -91,7 +123,11 @@ export function constructPkg(config: FyrConfiguration): Package {
                     if (f.length > 4 && f.substr(f.length - 4, 4) == ".fyr") {
                         files.push(path.join(p, f));
                     } else if (f.length > 2 && f.substr(f.length - 2, 2) == ".c") {
-                        nativeFiles.push(path.join(p, f));
+                        // The C files generated for x.fyr are x.c and x.unity.c. These are written into the same directory.
+                        let name = f.substr(0, f.length - 2).replace(/\.unity$/, "");
+                        if (allFiles.indexOf(name + ".fyr") == -1) {
+                            nativeFiles.push(path.join(p, f));
+                        }
                     }
                 }
                 pkg = new Package(true);
@@ -113,24 +149,49 @@ export function constructPkg(config: FyrConfiguration): Package {
     return pkg;
 }
 
-export function compile(pkg: Package, config: FyrConfiguration) {
+/**
+ * The returned promise is resolved once the native executable (if any) has been linked.
+ * It is resolved to false if an error has been reported.
+ */
+export function compile(pkg: Package, config: FyrConfiguration): Promise<boolean> {
     try {
         pkg.loadSources();
         Package.checkTypesForPackages();
+    } catch(e) {
+        config.errorHandler.handle(e);
+        return Promise.resolve(false);
+    }
+    return generateCode(config);
+}
 
-        // Generate code
-        if (!config.disableCodegen) {
-            let backend: "C" | "WASM" | null = null;
-            if (config.emitWasm) {
-                backend = "WASM";
-            } else if (config.emitC) {
-                backend = "C";
-            }
-            Package.generateCodeForPackages(backend, config.emitIr, config.emitNative, config.disableNullCheck);
-        }
+/**
+ * Compiles again after the files of the `changed` packages have been modified.
+ * All other packages are neither parsed nor typechecked again.
+ */
+export function recompile(changed: Array<Package>, config: FyrConfiguration): Promise<boolean> {
+    try {
+        Package.invalidate(changed);
     } catch(e) {
         config.errorHandler.handle(e);
+        return Promise.resolve(false);
     }
+    return generateCode(config);
+}
+
+function generateCode(config: FyrConfiguration): Promise<boolean> {
+    if (config.disableCodegen) {
+        return Promise.resolve(true);
+    }
+    let backend: "C" | "WASM" | null = null;
+    if (config.emitWasm) {
+        backend = "WASM";
+    } else if (config.emitC) {
+        backend = "C";
+    }
+    return Package.generateCodeForPackages(backend, config.emitIr, config.emitNative, config.disableNullCheck, config.jobs, config.lto, config.pgoGenerate, config.pgoUse, config.unity, config.forceBoundsChecks).then(() => true, (e) => {
+        config.errorHandler.handle(e);
+        return false;
+    });
 }
 
 // only parse if this file was required by fyrc
@@ -145,6 +206,13 @@ if (binaryPath.substring(binaryPath.length - 4, binaryPath.length) === 'fyrc') {
         .option('-c, --emit-c', "Emit C code")
         .option('-n, --emit-native', "Emit native executable")
         .option('-N, --disable-null-check', "Do not check for null pointers")
+        .option('--force-bounds-checks', "Check all indices, even those which are proven to be in range")
+        .option('-j, --jobs <n>', "Number of gcc processes running in parallel, defaults to the number of CPUs", parseInt)
+        .option('-W, --watch', "Keep running and compile again whenever a source file changes")
+        .option('-U, --unity', "Compile all packages as one translation unit with static functions")
+        .option('--lto', "Optimize across packages and the runtime when linking")
+        .option('--pgo-generate <dir>', "Build an executable that writes a profile to <dir> when it runs")
+        .option('--pgo-use <dir>', "Optimize with the profile in <dir>, which has been written by an executable built with --pgo-generate")
 //        .option('-T, --disable-runtime', "Do not include the standard runtime")
         .option('-G, --disable-codegen', "Do not generate any code, just perform syntax and typechecks")
 
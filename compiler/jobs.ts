@@ -0,0 +1,79 @@
+import child_process = require("child_process");
+import os = require("os");
+
+/**
+ * Runs a number of independent commands, e.g. invocations of gcc, with a bounded number of them at the same time.
+ */
+export class JobQueue {
+    /**
+     * @param parallel is the maximum number of commands running at the same time.
+     * Zero or less defaults to the number of CPUs.
+     */
+    constructor(parallel: number) {
+        this.parallel = parallel > 0 ? parallel : Math.max(1, os.cpus().length);
+    }
+
+    public add(command: string, args: Array<string>) {
+        this.jobs.push([command, args]);
+    }
+
+    /**
+     * Runs all commands that have been added.
+     * The promise is rejected when a command fails. In this case, no further commands are started,
+     * but the promise waits for the running commands to finish.
+     */
+    public run(): Promise<void> {
+        let jobs = this.jobs;
+        this.jobs = [];
+        return new Promise<void>((resolve, reject) => {
+            let next = 0;
+            let running = 0;
+            let failure: Error = null;
+            let startNext = () => {
+                while (failure == null && running < this.parallel && next < jobs.length) {
+                    let [command, args] = jobs[next++];
+                    console.log(command, args.join(" "));
+                    running++;
+                    let child = child_process.spawn(command, args, {stdio: ["ignore", "inherit", "inherit"]});
+                    // A child that cannot be started might report an error and exit
+                    let done = false;
+                    child.on("error", (e: Error) => {
+                        if (!done) {
+                            done = true;
+                            finish(e);
+                        }
+                    });
+                    child.on("exit", (code: number, signal: string) => {
+                        if (done) {
+                            return;
+                        }
+                        done = true;
+                        if (code != 0) {
+                            finish(new Error(command + " " + args.join(" ") + " failed with " + (signal ? signal : "exit code " + code)));
+                        } else {
+                            finish(null);
+                        }
+                    });
+                }
+                if (running == 0) {
+                    if (failure) {
+                        reject(failure);
+                    } else {
+                        resolve();
+                    }
+                }
+            };
+            let finish = (e: Error) => {
+                running--;
+                if (e && !failure) {
+                    failure = e;
+                }
+                startNext();
+            };
+            startNext();
+        });
+    }
+
+    private parallel: number;
+    private jobs: Array<[string, Array<string>]> = [];
+}
@@ -0,0 +1,309 @@
+import {Node, NodeOp, LocationPoint} from "./ast"
+
+// Increment whenever the encoding changes
+const formatVersion = 1;
+const magic = "FYRI";
+
+// Bits which tell which properties of a node are encoded
+enum NodeField {
+    Lhs = 1,
+    Rhs = 2,
+    Name = 4,
+    Condition = 8,
+    ElseBranch = 16,
+    GroupName = 32,
+    Value = 64,
+    Nspace = 128,
+    NumValue = 256,
+    Flags = 512,
+    Statements = 1024,
+    Parameters = 2048,
+    GenericParameters = 4096,
+    Loc = 8192
+}
+
+/**
+ * Encodes strings, numbers and AST nodes in a compact binary format.
+ * All strings, e.g. node operations and identifiers, are stored once in a string table and referenced by index.
+ * Numbers are stored as variable-length integers.
+ *
+ * Comments are not encoded.
+ */
+export class BinaryWriter {
+    constructor() {
+        this.buf = Buffer.alloc(4096);
+    }
+
+    public writeNumber(n: number) {
+        if (n < 0 || n != Math.floor(n)) {
+            throw new Error("Cannot encode " + n.toString());
+        }
+        this.ensure(8);
+        while (n >= 0x80) {
+            this.buf[this.pos++] = (n % 0x80) | 0x80;
+            n = Math.floor(n / 0x80);
+        }
+        this.buf[this.pos++] = n;
+    }
+
+    public writeString(s: string) {
+        let index = this.stringIndex.get(s);
+        if (index === undefined) {
+            index = this.strings.length;
+            this.strings.push(s);
+            this.stringIndex.set(s, index);
+        }
+        this.writeNumber(index);
+    }
+
+    /**
+     * @param omitBody returns true for nodes whose statements are not encoded, e.g. the bodies of functions.
+     */
+    public writeNode(n: Node, omitBody: (n: Node) => boolean) {
+        if (!n) {
+            this.writeNumber(0);
+            return;
+        }
+        let withBody = n.statements && !omitBody(n);
+        let fields = 0;
+        fields |= n.lhs ? NodeField.Lhs : 0;
+        fields |= n.rhs ? NodeField.Rhs : 0;
+        fields |= n.name ? NodeField.Name : 0;
+        fields |= n.condition ? NodeField.Condition : 0;
+        fields |= n.elseBranch ? NodeField.ElseBranch : 0;
+        fields |= n.groupName ? NodeField.GroupName : 0;
+        fields |= n.value !== undefined && n.value !== null ? NodeField.Value : 0;
+        fields |= n.nspace !== undefined && n.nspace !== null ? NodeField.Nspace : 0;
+        fields |= n.numValue !== undefined && n.numValue !== null ? NodeField.NumValue : 0;
+        fields |= n.flags ? NodeField.Flags : 0;
+        fields |= withBody ? NodeField.Statements : 0;
+        fields |= n.parameters ? NodeField.Parameters : 0;
+        fields |= n.genericParameters ? NodeField.GenericParameters : 0;
+        fields |= n.loc ? NodeField.Loc : 0;
+        // Zero encodes a null node
+        this.writeNumber(fields + 1);
+        this.writeString(n.op);
+        if (fields & NodeField.Lhs) {
+            this.writeNode(n.lhs, omitBody);
+        }
+        if (fields & NodeField.Rhs) {
+            this.writeNode(n.rhs, omitBody);
+        }
+        if (fields & NodeField.Name) {
+            this.writeNode(n.name, omitBody);
+        }
+        if (fields & NodeField.Condition) {
+            this.writeNode(n.condition, omitBody);
+        }
+        if (fields & NodeField.ElseBranch) {
+            this.writeNode(n.elseBranch, omitBody);
+        }
+        if (fields & NodeField.GroupName) {
+            this.writeNode(n.groupName, omitBody);
+        }
+        if (fields & NodeField.Value) {
+            this.writeString(n.value);
+        }
+        if (fields & NodeField.Nspace) {
+            this.writeString(n.nspace);
+        }
+        if (fields & NodeField.NumValue) {
+            this.ensure(8);
+            this.buf.writeDoubleLE(n.numValue, this.pos);
+            this.pos += 8;
+        }
+        if (fields & NodeField.Flags) {
+            this.writeNumber(n.flags);
+        }
+        if (fields & NodeField.Statements) {
+            this.writeNodes(n.statements.filter((s) => s.op != "comment"), omitBody);
+        }
+        if (fields & NodeField.Parameters) {
+            this.writeNodes(n.parameters, omitBody);
+        }
+        if (fields & NodeField.GenericParameters) {
+            this.writeNodes(n.genericParameters, omitBody);
+        }
+        if (fields & NodeField.Loc) {
+            this.writeString(n.loc.file ? n.loc.file : "");
+            this.writeLocationPoint(n.loc.start);
+            this.writeLocationPoint(n.loc.end);
+        }
+    }
+
+    public writeNodes(nodes: Array<Node>, omitBody: (n: Node) => boolean) {
+        this.writeNumber(nodes.length);
+        for(let n of nodes) {
+            this.writeNode(n, omitBody);
+        }
+    }
+
+    /**
+     * Returns the magic, the string table and the encoded data.
+     */
+    public finish(): Buffer {
+        let table = new BinaryWriter();
+        table.buf.write(magic, 0, magic.length, "latin1");
+        table.pos = magic.length;
+        table.writeNumber(formatVersion);
+        table.writeNumber(this.strings.length);
+        for(let s of this.strings) {
+            let b = Buffer.from(s, "utf8");
+            table.writeNumber(b.length);
+            table.ensure(b.length);
+            b.copy(table.buf, table.pos);
+            table.pos += b.length;
+        }
+        return Buffer.concat([table.buf.slice(0, table.pos), this.buf.slice(0, this.pos)]);
+    }
+
+    private writeLocationPoint(p: LocationPoint) {
+        this.writeNumber(p.offset);
+        this.writeNumber(p.line);
+        this.writeNumber(p.column);
+    }
+
+    private ensure(size: number) {
+        if (this.pos + size <= this.buf.length) {
+            return;
+        }
+        let b = Buffer.alloc(Math.max(this.buf.length * 2, this.pos + size));
+        this.buf.copy(b, 0, 0, this.pos);
+        this.buf = b;
+    }
+
+    private buf: Buffer;
+    private pos: number = 0;
+    private strings: Array<string> = [];
+    private stringIndex: Map<string, number> = new Map<string, number>();
+}
+
+/**
+ * Decodes the output of BinaryWriter.
+ * Throws Error if the data is malformed or has been written by another version of the encoding.
+ */
+export class BinaryReader {
+    constructor(buf: Buffer) {
+        this.buf = buf;
+        if (buf.length < magic.length || buf.toString("latin1", 0, magic.length) != magic) {
+            throw new Error("Not a Fyr interface");
+        }
+        this.pos = magic.length;
+        if (this.readNumber() != formatVersion) {
+            throw new Error("Unsupported version of the Fyr interface format");
+        }
+        let count = this.readNumber();
+        for(let i = 0; i < count; i++) {
+            let len = this.readNumber();
+            this.check(len);
+            this.strings.push(buf.toString("utf8", this.pos, this.pos + len));
+            this.pos += len;
+        }
+    }
+
+    public readNumber(): number {
+        let n = 0;
+        let factor = 1;
+        while (true) {
+            this.check(1);
+            let b = this.buf[this.pos++];
+            n += (b & 0x7f) * factor;
+            if ((b & 0x80) == 0) {
+                return n;
+            }
+            factor *= 0x80;
+        }
+    }
+
+    public readString(): string {
+        let index = this.readNumber();
+        if (index >= this.strings.length) {
+            throw new Error("Malformed Fyr interface");
+        }
+        return this.strings[index];
+    }
+
+    public readNode(): Node {
+        let fields = this.readNumber();
+        if (fields == 0) {
+            return null;
+        }
+        fields--;
+        let n = new Node();
+        n.op = this.readString() as NodeOp;
+        if (fields & NodeField.Lhs) {
+            n.lhs = this.readNode();
+        }
+        if (fields & NodeField.Rhs) {
+            n.rhs = this.readNode();
+        }
+        if (fields & NodeField.Name) {
+            n.name = this.readNode();
+        }
+        if (fields & NodeField.Condition) {
+            n.condition = this.readNode();
+        }
+        if (fields & NodeField.ElseBranch) {
+            n.elseBranch = this.readNode();
+        }
+        if (fields & NodeField.GroupName) {
+            n.groupName = this.readNode();
+        }
+        if (fields & NodeField.Value) {
+            n.value = this.readString();
+        }
+        if (fields & NodeField.Nspace) {
+            n.nspace = this.readString();
+        }
+        if (fields & NodeField.NumValue) {
+            this.check(8);
+            n.numValue = this.buf.readDoubleLE(this.pos);
+            this.pos += 8;
+        }
+        if (fields & NodeField.Flags) {
+            n.flags = this.readNumber();
+        }
+        if (fields & NodeField.Statements) {
+            n.statements = this.readNodes();
+        }
+        if (fields & NodeField.Parameters) {
+            n.parameters = this.readNodes();
+        }
+        if (fields & NodeField.GenericParameters) {
+            n.genericParameters = this.readNodes();
+        }
+        if (fields & NodeField.Loc) {
+            let file = this.readString();
+            let start = this.readLocationPoint();
+            let end = this.readLocationPoint();
+            n.loc = {file: file, start: start, end: end};
+        }
+        return n;
+    }
+
+    public readNodes(): Array<Node> {
+        let count = this.readNumber();
+        let nodes: Array<Node> = [];
+        for(let i = 0; i < count; i++) {
+            nodes.push(this.readNode());
+        }
+        return nodes;
+    }
+
+    private readLocationPoint(): LocationPoint {
+        let offset = this.readNumber();
+        let line = this.readNumber();
+        let column = this.readNumber();
+        return {offset: offset, line: line, column: column};
+    }
+
+    private check(size: number) {
+        if (this.pos + size > this.buf.length) {
+            throw new Error("Malformed Fyr interface");
+        }
+    }
+
+    private buf: Buffer;
+    private pos: number;
+    private strings: Array<string> = [];
+}
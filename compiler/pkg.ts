@@ -12,10 +12,14 @@ import { TypeChecker, Static } from './typecheck'
 import {FunctionType, UnsafePointerType} from "./types/";
 import {CodeGenerator} from "./codegen";
 import * as backend from "./backend/backend";
+import * as ssa from "./ssa";
 import {Wasm32Backend} from "./backend/backend_wasm";
 import {CBackend} from "./backend/backend_c";
 import {DummyBackend} from "./backend/backend_dummy";
 import { ImplementationError, ImportError, SyntaxError } from './errors'
+import {JobQueue} from "./jobs"
+import {BinaryReader, BinaryWriter} from "./parser/astcodec"
+import {createHash} from "crypto";
 
 
 // Make TSC not throw out the colors lib
@@ -99,8 +103,13 @@ export class Package {
         this.binFilePath = path.join(fyrPath, "bin", architecture);
         this.binFileName = this.objFileName;
         Package.packagesByPath.set(pkgPath, this);
+        this.listSources();
+    }
 
-        // Determine all filenames
+    /**
+     * Determines all filenames in the source directory of the package.
+     */
+    private listSources() {
         let p = this.sourcePath();
         let allFiles = fs.readdirSync(p);
         for(let f of allFiles) {
@@ -135,25 +144,42 @@ export class Package {
         if (this.isInternal) {
             return;
         }
-        // Parse all files into a single AST
         this.pkgNode = new ast.Node({loc: null, op: "module", statements: []});
+        let hash = createHash("md5");
+        let codes: Array<string> = [];
         for(let file of this.files) {
-            ast.setCurrentFile(file);
             let fileResolved = path.resolve(file);
-            console.log("Parsing " + fileResolved + " ...");
             let code: string;
             try {
                 code = fs.readFileSync(fileResolved, 'utf8') + "\n";
             } catch(e) {
                 throw new ImportError(("Cannot read file " + file).red, null, this.pkgPath);
             }
-            // Remove windows line ending
-            code = code.replace(/\r/g, "");
-            try {
-                let f = parser.parse(code);
-                this.pkgNode.statements.push(f);
-            } catch (e) {
-                throw new SyntaxError(e.message, {start: e.location.start, end: e.location.end, file: ""})
+            hash.update(file);
+            hash.update(code);
+            codes.push(code);
+        }
+        this.sourceHash = hash.digest("hex");
+
+        // An imported package can be loaded from its interface instead
+        let nodes = this.isImported && !this.forceSources ? this.readInterface() : null;
+        this.fromInterface = !!nodes;
+        if (nodes) {
+            console.log("Loading interface of " + this.pkgPath + " ...");
+            this.pkgNode.statements = nodes;
+        } else {
+            // Parse all files into a single AST
+            for(let i = 0; i < this.files.length; i++) {
+                ast.setCurrentFile(this.files[i]);
+                console.log("Parsing " + path.resolve(this.files[i]) + " ...");
+                // Remove windows line ending
+                let code = codes[i].replace(/\r/g, "");
+                try {
+                    let f = parser.parse(code);
+                    this.pkgNode.statements.push(f);
+                } catch (e) {
+                    throw new SyntaxError(e.message, {start: e.location.start, end: e.location.end, file: ""})
+                }
             }
         }
 
@@ -162,6 +188,38 @@ export class Package {
         this.typeCheckPass = 1;
     }
 
+    /**
+     * Discards the AST, the scope and the typechecker state of the package, and loads the sources again.
+     * Might throw SyntaxError or ImportError or TypeError.
+     */
+    private reload() {
+        this.stale = false;
+        this.pkgNode = null;
+        this.scope = null;
+        this.codegen = null;
+        this.tc = new tc.TypeChecker(this);
+        this.typeCheckPass = 0;
+        this.imports = [];
+        // These are set again by the config statement of the package
+        this.compileCmdLineArgs = null;
+        this.linkCmdLineArgs = null;
+        this.stackSize = 0;
+        this.biasedRC = false;
+        if (this.fyrPath && this.pkgPath) {
+            // Files might have been added or removed
+            this.files = [];
+            this.nativeFiles = [];
+            this.listSources();
+        }
+        try {
+            this.loadSources();
+        } catch(e) {
+            // Try again upon the next call to Package.invalidate
+            this.stale = true;
+            throw e;
+        }
+    }
+
     /**
      * Might throw TypeError
      */
@@ -192,21 +250,25 @@ export class Package {
         this.tc.checkModulePassFour();
     }
 
-    public generateCode(backend: "C" | "WASM" | null, emitIR: boolean, initPackages: Array<Package> | null, duplicateCodePackages: Array<Package>,  disableNullCheck: boolean) {
+    /**
+     * @param component is the package whose config applies to the generated code, i.e. the main package.
+     */
+    public generateCode(backend: "C" | "WASM" | null, emitIR: boolean, initPackages: Array<Package> | null, duplicateCodePackages: Array<Package>,  disableNullCheck: boolean, component: Package | null, unity: boolean = false, forceBoundsChecks: boolean = false) {
         if (this.isInternal) {
             return;
         }
 
         console.log("Compiling " + (this.pkgPath ? this.pkgPath : path.join(this.objFilePath, this.objFileName)) + " ...");
+        this.inlineBodies.clear();
 
         let cBackend: CBackend;
         let wasmBackend: Wasm32Backend;
         let b: backend.Backend;
         if (backend == "C") {
-            cBackend = new CBackend(this);
+            cBackend = new CBackend(this, component, unity, forceBoundsChecks);
             b = cBackend;
         } else if (backend == "WASM") {
-            wasmBackend = new Wasm32Backend();
+            wasmBackend = new Wasm32Backend(forceBoundsChecks);
             b = wasmBackend;
         } else {
             b = new DummyBackend();
@@ -247,48 +309,323 @@ export class Package {
         }
 
         this.hasInitFunction = (b.getInitFunction() != null);
+        this.hasDuplicateCode = this.tc.hasTemplateInstantiations() || this.codegen.hasDestructors() || this.codegen.hasSymbols();
     }
 
-    public generateObjectFiles(backend: "C" | "WASM" | null, nativePackages: Array<Package>) {
-        // Compile the *.c and *.h files to *.o files
-        if (backend == "C") {
-            let cfile = path.join(this.objFilePath, this.objFileName + ".c");
-            let ofile = path.join(this.objFilePath, this.objFileName + ".o");
-            let includes: Array<string> = [];
-            // Make fyr.h discoverable
-            includes.push("-I" + path.join(Package.fyrBase, "src", "runtime"));
-            for (let p of Package.fyrPaths) {
-                includes.push("-I" + path.join(p, "pkg", architecture));
+    /**
+     * Records that the typechecker or the code generator of this package uses the package `p`.
+     */
+    public addImport(p: Package) {
+        if (p != this && this.imports.indexOf(p) == -1) {
+            this.imports.push(p);
+        }
+    }
+
+    /**
+     * Returns a hash over everything the generated code of the package depends on:
+     * the compiler, the build flags, the sources of the package and the input hashes of all imported packages.
+     * Imported packages are hashed by their input, too, because template instantiations depend on their sources.
+     * The main package furthermore depends on all packages of the build, since it calls their init functions.
+     */
+    public inputHash(flags: string): string {
+        if (this.inputHashCache) {
+            return this.inputHashCache;
+        }
+        let hash = createHash("md5");
+        hash.update(compilerFingerprint());
+        hash.update(flags);
+        hash.update(this.sourceHash);
+        let files = this.nativeFiles.slice();
+        if (this.fyrPath) {
+            // Header files of the package can be included by native files and imports
+            for(let f of fs.readdirSync(this.sourcePath()).sort()) {
+                if (f.length > 2 && f.substr(f.length - 2, 2) == ".h") {
+                    files.push(path.join(this.sourcePath(), f));
+                }
+            }
+        }
+        for(let f of files) {
+            hash.update(f);
+            hash.update(fs.readFileSync(f));
+        }
+        let deps = this == Package.mainPackage ? Package.packages : this.imports;
+        for(let p of deps) {
+            if (p == this) {
+                continue;
+            }
+            hash.update(p.pkgPath ? p.pkgPath : "");
+            if (!p.isInternal) {
+                hash.update(p.inputHash(flags));
+            }
+        }
+        this.inputHashCache = hash.digest("hex");
+        return this.inputHashCache;
+    }
+
+    /**
+     * Returns true if the manifest of the previous build shows that the generated code is still up to date.
+     * In this case the results of the code generation are restored from the manifest.
+     */
+    public isUpToDate(flags: string, emitIR: boolean): boolean {
+        if (!this.matchesManifest(flags, emitIR)) {
+            return false;
+        }
+        console.log((this.pkgPath ? this.pkgPath : path.join(this.objFilePath, this.objFileName)) + " is up to date");
+        this.hasMain = this.manifest.hasMain;
+        this.hasInitFunction = this.manifest.hasInitFunction;
+        this.hasDuplicateCode = this.manifest.hasDuplicateCode;
+        this.inlineBodies.clear();
+        let bodies = this.manifest.inlineBodies || {};
+        for(let name in bodies) {
+            this.inlineBodies.set(name, ssa.Optimizer.decodeFunction(bodies[name]));
+        }
+        return true;
+    }
+
+    private matchesManifest(flags: string, emitIR: boolean): boolean {
+        if (!this.manifest || this.manifest.inputHash != this.inputHash(flags)) {
+            return false;
+        }
+        let base = path.join(this.objFilePath, this.objFileName);
+        let outputs = [base + ".c", base + ".h"];
+        if (emitIR) {
+            outputs.push(base + ".ir");
+        }
+        for(let f of outputs) {
+            if (!fs.existsSync(f)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    private manifestFile(): string {
+        return path.join(this.objFilePath, this.objFileName + ".manifest");
+    }
+
+    private readManifest(): PackageManifest {
+        try {
+            return JSON.parse(fs.readFileSync(this.manifestFile(), 'utf8'));
+        } catch(e) {
+            return null;
+        }
+    }
+
+    private writeManifest(flags: string) {
+        let bodies: {[name: string]: ssa.EncodedFunction} = {};
+        this.inlineBodies.forEach((n, name) => bodies[name] = ssa.Optimizer.encodeFunction(n));
+        let m: PackageManifest = {
+            inputHash: this.inputHash(flags),
+            imports: this.imports.filter((p) => !!p.pkgPath).map((p) => p.pkgPath),
+            hasMain: !!this.hasMain,
+            hasInitFunction: !!this.hasInitFunction,
+            hasDuplicateCode: !!this.hasDuplicateCode,
+            objects: this.objects,
+            inlineBodies: bodies
+        };
+        fs.writeFileSync(this.manifestFile(), JSON.stringify(m), 'utf8');
+    }
+
+    private interfaceFile(): string {
+        return path.join(this.objFilePath, this.objFileName + ".fyri");
+    }
+
+    /**
+     * Returns the AST stored in the interface of the package, or null if there is no interface or if it is outdated.
+     * The interface is up to date if neither the compiler nor the files of the package
+     * and the packages it imports directly or indirectly have changed.
+     */
+    private readInterface(): Array<ast.Node> {
+        let buf: Buffer;
+        try {
+            buf = fs.readFileSync(this.interfaceFile());
+        } catch(e) {
+            return null;
+        }
+        try {
+            let r = new BinaryReader(buf);
+            if (r.readString() != compilerFingerprint() || r.readString() != Package.hashSourceDirectory(this.sourcePath())) {
+                return null;
             }
-            for(let p of nativePackages) {
-                includes.push("-I" + p.sourcePath());
+            let count = r.readNumber();
+            for(let i = 0; i < count; i++) {
+                let pkgPath = r.readString();
+                let digest = r.readString();
+                let dir = Package.findSourceDirectory(pkgPath);
+                if (!dir || Package.hashSourceDirectory(dir) != digest) {
+                    return null;
+                }
             }
-            let args = includes.concat(["-g3", "-O3", "-Wno-parentheses", "-o", ofile, "-c", cfile]);
-            if (this.compileCmdLineArgs) {
-                args = args.concat(this.compileCmdLineArgs);
+            return r.readNodes();
+        } catch(e) {
+            // A malformed interface is treated like a missing one
+            return null;
+        }
+    }
+
+    /**
+     * Writes the interface of the package next to its object file.
+     * The interface is the AST of the package without the bodies of all functions which are not templates.
+     * Importing the package from its interface saves parsing the sources and typechecking the function bodies.
+     */
+    private writeInterface() {
+        let w = new BinaryWriter();
+        w.writeString(compilerFingerprint());
+        w.writeString(Package.hashSourceDirectory(this.sourcePath()));
+        // All packages which are imported directly or indirectly
+        let deps: Array<Package> = this.imports.filter((p) => !p.isInternal);
+        for(let i = 0; i < deps.length; i++) {
+            for(let p of deps[i].imports) {
+                if (!p.isInternal && p != this && deps.indexOf(p) == -1) {
+                    deps.push(p);
+                }
+            }
+        }
+        w.writeNumber(deps.length);
+        for(let p of deps) {
+            w.writeString(p.pkgPath);
+            w.writeString(Package.hashSourceDirectory(p.sourcePath()));
+        }
+        let bodies = new Set<ast.Node>(this.tc.functionNodes());
+        w.writeNodes(this.pkgNode.statements, (n) => bodies.has(n));
+        fs.writeFileSync(this.interfaceFile(), w.finish());
+    }
+
+    /**
+     * Adds the gcc invocations which compile the *.c files of the package to *.o files to the queue.
+     * In a unity build, the generated *.c file is compiled by generateUnityObjectFile and only native files are compiled here.
+     */
+    public generateObjectFiles(backend: "C" | "WASM" | null, nativePackages: Array<Package>, cflags: Array<string>, unity: boolean, flags: string, queue: JobQueue) {
+        // Compile the *.c and *.h files to *.o files
+        if (backend == "C") {
+            let biasedRC = !!Package.mainPackage && Package.mainPackage.biasedRC;
+            if (!unity) {
+                let cfile = path.join(this.objFilePath, this.objFileName + ".c");
+                let ofile = path.join(this.objFilePath, this.objFileName + ".o");
+                let args = Package.generatedCodeIncludes(nativePackages).concat(cflags, ["-Wno-parentheses", "-o", ofile, "-c", cfile]);
+                if (biasedRC) {
+                    // Static strings contain the header fields of biased reference counting
+                    args.push("-DFYR_BIASED_RC");
+                }
+                if (this.compileCmdLineArgs) {
+                    args = args.concat(this.compileCmdLineArgs);
+                }
+                this.addObjectFile(ofile, args, flags, queue);
             }
-            console.log("gcc", args.join(" "));
-            child_process.execFileSync("gcc", args);
 
             if (this.nativeFiles) {
                 for(let cfile of this.nativeFiles) {
                     let filename = path.basename(cfile, ".c");
                     let ofile = path.join(this.objFilePath, filename + ".o");
                     let includes: Array<string> = [];
+                    // Native files may use the runtime, e.g. fyr_spawn.h
+                    includes.push("-I" + path.join(Package.fyrBase, "src", "runtime"));
                     for(let p of nativePackages) {
                         includes.push("-I" + p.sourcePath());
                     }
-                    let args = includes.concat(["-g3", "-O3", "-Wno-parentheses", "-o", ofile, "-c", cfile]);
+                    let args = includes.concat(cflags, ["-Wno-parentheses", "-o", ofile, "-c", cfile]);
+                    if (biasedRC) {
+                        args.push("-DFYR_BIASED_RC");
+                    }
                     if (this.compileCmdLineArgs) {
                         args = args.concat(this.compileCmdLineArgs);
                     }
-                    console.log("gcc", args.join(" "));
-                    child_process.execFileSync("gcc", args);
+                    this.addObjectFile(ofile, args, flags, queue);
                 }
             }
         }
     }
 
+    /**
+     * Writes a C file which includes the generated *.c files of all packages, such that gcc sees the whole program
+     * in one translation unit. This package is included last, since it calls the init functions of the others.
+     * Adds the gcc invocation which compiles the file to the queue and returns the object file.
+     */
+    public generateUnityObjectFile(nativePackages: Array<Package>, cflags: Array<string>, flags: string, queue: JobQueue): string {
+        let biasedRC = !!Package.mainPackage && Package.mainPackage.biasedRC;
+        // Possibly duplicated code in the header files is emitted once, when the first header containing it is included
+        let code = "#define FYR_COMPILE_MAIN\n\n";
+        let args: Array<string> = [];
+        for(let p of Package.packages.filter((p) => !p.isInternal && p != this).concat([this])) {
+            code += "#include \"" + path.join(p.objFilePath, p.objFileName + ".c") + "\"\n";
+            if (p.compileCmdLineArgs) {
+                args = args.concat(p.compileCmdLineArgs);
+            }
+        }
+        let cfile = path.join(this.objFilePath, this.objFileName + ".unity.c");
+        let ofile = path.join(this.objFilePath, this.objFileName + ".unity.o");
+        // Rewriting an unchanged file would trigger another build in watch mode
+        let previous: string = null;
+        try {
+            previous = fs.readFileSync(cfile, 'utf8');
+        } catch(e) {
+            // The file does not exist yet
+        }
+        if (previous != code) {
+            fs.writeFileSync(cfile, code, 'utf8');
+        }
+        args = Package.generatedCodeIncludes(nativePackages).concat(cflags, ["-Wno-parentheses", "-o", ofile, "-c", cfile], args);
+        if (biasedRC) {
+            args.push("-DFYR_BIASED_RC");
+        }
+        this.addObjectFile(ofile, args, flags, queue);
+        return ofile;
+    }
+
+    /**
+     * Returns the include paths for compiling generated code: the runtime, the header files of all packages
+     * and the source directories of packages with native files.
+     */
+    private static generatedCodeIncludes(nativePackages: Array<Package>): Array<string> {
+        let includes: Array<string> = [];
+        // Make fyr.h discoverable
+        includes.push("-I" + path.join(Package.fyrBase, "src", "runtime"));
+        for (let p of Package.fyrPaths) {
+            includes.push("-I" + path.join(p, "pkg", architecture));
+        }
+        for(let p of nativePackages) {
+            includes.push("-I" + p.sourcePath());
+        }
+        return includes;
+    }
+
+    /**
+     * Adds the gcc invocations which compile the runtime with `cflags` to the queue.
+     * The object files are placed next to the object file of this package. Returns the object files.
+     * Without LTO or PGO, the precompiled runtime in the `pkg` directory of the Fyr installation is linked instead.
+     */
+    public generateRuntimeObjectFiles(cflags: Array<string>, biasedRC: boolean, flags: string, queue: JobQueue): Array<string> {
+        let runtime = path.join(Package.fyrBase, "src", "runtime");
+        let cfiles = ["fyr.c", "fyr_spawn.c"];
+        let oFiles: Array<string> = [];
+        for(let f of cfiles) {
+            let ofile = path.join(this.objFilePath, this.objFileName + "-" + path.basename(f, ".c") + ".o");
+            let args = cflags.concat(["-o", ofile, "-c", path.join(runtime, f)]);
+            if (biasedRC) {
+                args.push("-DFYR_BIASED_RC");
+            }
+            this.addObjectFile(ofile, args, flags, queue);
+            oFiles.push(ofile);
+        }
+        return oFiles;
+    }
+
+    /**
+     * Adds a gcc invocation to the queue, unless the object file has been compiled with the same arguments
+     * from the same inputs before.
+     */
+    private addObjectFile(ofile: string, args: Array<string>, flags: string, queue: JobQueue) {
+        let hash = createHash("md5");
+        hash.update(this.inputHash(flags));
+        hash.update(args.join(" "));
+        let key = hash.digest("hex");
+        if (this.objects[ofile] == key && fs.existsSync(ofile)) {
+            return;
+        }
+        this.objects[ofile] = key;
+        queue.add("gcc", args);
+    }
+
     /**
      * Might throw ImportError
      */
@@ -378,14 +715,64 @@ export class Package {
 
     /**
      * Generates C or WASM files and optionally compiles and links these files to create a native executable.
+     * Up to `jobs` gcc processes run in parallel. Zero defaults to the number of CPUs.
+     * `lto` enables link-time optimization. `pgoGenerate` is a directory in which the executable writes
+     * its profile when it runs. The profile in the directory `pgoUse` guides the optimization of the packages.
+     * `unity` compiles the generated code of all packages as one translation unit (only for the C backend).
+     * `forceBoundsChecks` keeps all bounds checks, even those which the optimizer proves to be redundant.
+     * The returned promise is resolved once the executable has been linked.
      */
-    public static generateCodeForPackages(backend: "C" | "WASM" | null, emitIR: boolean, emitNative: boolean, disableNullCheck: boolean) {
+    public static async generateCodeForPackages(backend: "C" | "WASM" | null, emitIR: boolean, emitNative: boolean, disableNullCheck: boolean, jobs: number, lto: boolean = false, pgoGenerate: string = null, pgoUse: string = null, unity: boolean = false, forceBoundsChecks: boolean = false): Promise<void> {
+        let biasedRC = !!Package.mainPackage && Package.mainPackage.biasedRC;
+        // Hashes of a previous build in the same process might be outdated
+        for(let p of Package.packages) {
+            p.inputHashCache = null;
+        }
+        // Packages whose inputs did not change since the last build are neither generated nor compiled again.
+        // This is only supported for C, because the other backends do not write manifests.
+        let incremental = backend == "C";
+        // Everything besides the sources that influences the generated code
+        let flags = JSON.stringify([backend, emitIR, disableNullCheck, biasedRC, Package.mainPackage ? Package.mainPackage.stackSize : 0, unity, forceBoundsChecks]);
+        if (incremental) {
+            Package.loadManifests();
+        }
+        // Packages loaded from their interface lack the function bodies.
+        // If code must be generated for them, they and their importers are loaded from the sources again.
+        while (true) {
+            let outdated = Package.packages.filter((p) => p.fromInterface && !(incremental && p.matchesManifest(flags, emitIR)));
+            if (outdated.length == 0) {
+                break;
+            }
+            Package.invalidate(outdated, true);
+            for(let p of Package.packages) {
+                p.inputHashCache = null;
+            }
+            if (incremental) {
+                Package.loadManifests();
+            }
+        }
         // Generate code (in the case of "C" this is source code)
         let initPackages: Array<Package> = [];
         // Packages that contain native files, e.g. *.c
         let nativePackages: Array<Package> = [];
         // Packages that contain (possibly duplicate) code in their header file
         let duplicateCodePackages: Array<Package> = [];
+        // Imported packages are generated before their importers, which can then inline their small functions.
+        // Code generation can import further packages, hence the order is computed again for each package.
+        let done = new Set<Package>();
+        while (true) {
+            let p = Package.importOrder().find((p) => !done.has(p));
+            if (!p) {
+                break;
+            }
+            done.add(p);
+            if (p == Package.mainPackage || p.isInternal) {
+                continue;
+            }
+            if (!incremental || !p.isUpToDate(flags, emitIR)) {
+                p.generateCode(backend, emitIR, null, null, disableNullCheck, Package.mainPackage, unity, forceBoundsChecks);
+            }
+        }
         for(let p of Package.packages) {
             // Does the package have native files, e.g. *.c?
             if (p.nativeFiles.length != 0) {
@@ -394,16 +781,31 @@ export class Package {
             if (p == Package.mainPackage || p.isInternal) {
                 continue;
             }
-            p.generateCode(backend, emitIR, null, null, disableNullCheck);
             if (p.hasInitFunction) {
                 initPackages.push(p);
             }
-            if (p.tc.hasTemplateInstantiations() || p.codegen.hasDestructors() || p.codegen.hasSymbols()) {
+            if (p.hasDuplicateCode) {
                 duplicateCodePackages.push(p);
             }
         }
-        if (Package.mainPackage) {
-            Package.mainPackage.generateCode(backend, emitIR, initPackages, duplicateCodePackages, disableNullCheck);
+        if (Package.mainPackage && (!incremental || !Package.mainPackage.isUpToDate(flags, emitIR))) {
+            Package.mainPackage.generateCode(backend, emitIR, initPackages, duplicateCodePackages, disableNullCheck, Package.mainPackage, unity, forceBoundsChecks);
+        }
+
+        if (incremental) {
+            // Code generation might have imported further packages. Hash again to record the final state.
+            for(let p of Package.packages) {
+                p.inputHashCache = null;
+            }
+            for(let p of Package.packages) {
+                if (!p.isInternal) {
+                    p.writeManifest(flags);
+                }
+                // Only imported packages are loaded from their interface
+                if (p.isImported && !p.fromInterface && p.fyrPath) {
+                    p.writeInterface();
+                }
+            }
         }
 
         // Create native executable?
@@ -412,12 +814,32 @@ export class Package {
                 throw new ImplementationError()
             }
 
-            // Generate object files
+            let cflags = Package.optimizationFlags(lto, pgoGenerate, pgoUse);
+            // A changed profile must be applied to all object files, even if their sources did not change
+            let objFlags = pgoUse ? flags + Package.profileFingerprint(pgoUse) : flags;
+            // Generate object files. The gcc invocations are independent of each other.
+            let queue = new JobQueue(jobs);
             for(let p of Package.packages) {
                 if (p.isInternal) {
                     continue;
                 }
-                p.generateObjectFiles(backend, nativePackages);
+                p.generateObjectFiles(backend, nativePackages, cflags, unity, objFlags, queue);
+            }
+            let unityFile: string = null;
+            if (unity && Package.mainPackage) {
+                unityFile = Package.mainPackage.generateUnityObjectFile(nativePackages, cflags, objFlags, queue);
+            }
+            // The precompiled runtime is optimized without LTO or profile. Compile it along with the packages in this case.
+            let runtimeFiles: Array<string> = null;
+            if ((lto || pgoGenerate || pgoUse) && Package.mainPackage) {
+                runtimeFiles = Package.mainPackage.generateRuntimeObjectFiles(cflags, biasedRC, objFlags, queue);
+            }
+            await queue.run();
+            // Record the object files which are now up to date
+            for(let p of Package.packages) {
+                if (!p.isInternal) {
+                    p.writeManifest(flags);
+                }
             }
 
             // Run the linker on the package that contains a main function and is not itself imported
@@ -426,15 +848,28 @@ export class Package {
                     if (backend == "C") {
                         // List of all object files
                         let oFiles: Array<string> = [];
-                        // Always include fyr.o and fyr_spawn.o
-                        oFiles.push(path.join(Package.fyrBase, "pkg", architecture, "fyr.o"));
-                        oFiles.push(path.join(Package.fyrBase, "pkg", architecture, "fyr_spawn.o"));
                         let extraArgs: Array<string> = [];
+                        if (unityFile) {
+                            oFiles.push(unityFile);
+                        }
+                        if (runtimeFiles) {
+                            oFiles = oFiles.concat(runtimeFiles);
+                        } else {
+                            // Always include fyr.o and fyr_spawn.o (or their variants with biased reference counting)
+                            oFiles.push(path.join(Package.fyrBase, "pkg", architecture, biasedRC ? "fyr_brc.o" : "fyr.o"));
+                            oFiles.push(path.join(Package.fyrBase, "pkg", architecture, biasedRC ? "fyr_spawn_brc.o" : "fyr_spawn.o"));
+                        }
+                        if (biasedRC) {
+                            // Thread ids are recycled via thread-specific data
+                            extraArgs.push("-pthread");
+                        }
                         for(let importPkg of Package.packages) {
                             if (importPkg.isInternal) {
                                 continue;
                             }
-                            oFiles.push(path.join(importPkg.objFilePath, importPkg.objFileName + ".o"));
+                            if (!unityFile) {
+                                oFiles.push(path.join(importPkg.objFilePath, importPkg.objFileName + ".o"));
+                            }
                             if (importPkg.linkCmdLineArgs) {
                                 extraArgs = extraArgs.concat(importPkg.linkCmdLineArgs);
                             }
@@ -446,7 +881,8 @@ export class Package {
                             }
                         }
                         let bFile = path.join(p.binFilePath, p.binFileName);
-                        let args = ["-o", bFile, "-g3"].concat(oFiles);
+                        // With LTO, the optimization happens when linking. With PGO, the executable must be linked with libgcov.
+                        let args = ["-o", bFile].concat(lto || pgoGenerate || pgoUse ? cflags : ["-g3"], oFiles);
                         args = args.concat(extraArgs);
                         console.log("gcc", args.join(" "));
                         child_process.execFileSync("gcc", args);
@@ -456,6 +892,160 @@ export class Package {
         }
     }
 
+    /**
+     * Returns the gcc flags for compiling packages and the runtime.
+     * The same flags are passed to the linker when LTO or PGO is enabled.
+     */
+    private static optimizationFlags(lto: boolean, pgoGenerate: string, pgoUse: string): Array<string> {
+        let cflags = ["-g3", "-O3"];
+        if (lto) {
+            // Use as many parallel LTO jobs as there are CPUs
+            cflags.push("-flto=auto");
+        }
+        if (pgoGenerate) {
+            cflags.push("-fprofile-generate=" + path.resolve(pgoGenerate));
+        }
+        if (pgoUse) {
+            // Code that did not run while profiling is not a reason for warnings
+            cflags.push("-fprofile-use=" + path.resolve(pgoUse), "-fprofile-partial-training", "-Wno-missing-profile");
+        }
+        return cflags;
+    }
+
+    /**
+     * Returns a hash of the names, sizes and modification times of all files in the profile directory.
+     */
+    private static profileFingerprint(dir: string): string {
+        let hash = createHash("md5");
+        let files: Array<string>;
+        try {
+            files = fs.readdirSync(dir).sort();
+        } catch(e) {
+            throw new ImportError(("Cannot read the profile directory " + dir).red, null, dir);
+        }
+        for(let f of files) {
+            let stat = fs.statSync(path.join(dir, f));
+            hash.update(f + ":" + stat.size + ":" + stat.mtime.getTime());
+        }
+        return hash.digest("hex");
+    }
+
+    /**
+     * Reads the manifests of the previous build and loads the packages they import.
+     * Packages imported by the code generator would otherwise be unknown until the code is generated.
+     */
+    private static loadManifests() {
+        // Loading imports might append further packages
+        for(let i = 0; i < Package.packages.length; i++) {
+            let p = Package.packages[i];
+            if (p.isInternal) {
+                continue;
+            }
+            p.manifest = p.readManifest();
+            if (!p.manifest) {
+                continue;
+            }
+            p.objects = p.manifest.objects || {};
+            for(let pkgPath of p.manifest.imports || []) {
+                try {
+                    p.addImport(Package.resolve(pkgPath, null));
+                } catch(e) {
+                    // The package is gone. Its former importer must be generated again.
+                    p.manifest = null;
+                    break;
+                }
+            }
+        }
+        Package.checkTypesForPackages();
+    }
+
+    /**
+     * Prepares a rebuild after the files of the `changed` packages have been modified.
+     * These packages and all packages importing them directly or indirectly are parsed and typechecked again.
+     * All other packages keep their state. Packages which are no longer imported are removed from the build.
+     *
+     * Returns the packages that have been loaded again.
+     * Might throw SyntaxError or ImportError or TypeError.
+     */
+    public static invalidate(changed: Array<Package>, forceSources: boolean = false): Array<Package> {
+        // Packages which failed to load last time are still stale
+        let affected = Package.packages.filter((p) => !p.isInternal && (p.stale || changed.indexOf(p) != -1));
+        for(let i = 0; i < affected.length; i++) {
+            for(let p of Package.packages) {
+                if (affected.indexOf(p) == -1 && p.imports.indexOf(affected[i]) != -1) {
+                    affected.push(p);
+                }
+            }
+        }
+        for(let p of affected) {
+            p.stale = true;
+            // Only the changed packages must be parsed. Their importers might still use their interface.
+            p.forceSources = p.forceSources || (forceSources && changed.indexOf(p) != -1);
+        }
+        // Package.resolve reloads stale packages as well, which ensures that imports are loaded first
+        for(let p of affected) {
+            if (p.stale) {
+                p.reload();
+            }
+        }
+        Package.checkTypesForPackages();
+
+        // Remove packages which are no longer reachable from the packages being built
+        let reachable: Array<Package> = Package.packages.filter((p) => p.isInternal || !p.isImported);
+        for(let i = 0; i < reachable.length; i++) {
+            for(let p of reachable[i].imports) {
+                if (reachable.indexOf(p) == -1) {
+                    reachable.push(p);
+                }
+            }
+        }
+        for(let p of Package.packages) {
+            if (reachable.indexOf(p) == -1 && Package.packagesByPath.get(p.pkgPath) == p) {
+                Package.packagesByPath.delete(p.pkgPath);
+            }
+        }
+        Package.packages = Package.packages.filter((p) => reachable.indexOf(p) != -1);
+        return affected;
+    }
+
+    /**
+     * Returns the directory in the Fyr paths which contains the package, or null.
+     */
+    private static findSourceDirectory(pkgPath: string): string {
+        for(let p of Package.fyrPaths) {
+            let dir = path.join(path.join(p, "src"), pkgPath);
+            try {
+                if (fs.lstatSync(dir).isDirectory()) {
+                    return dir;
+                }
+            } catch(e) {
+                // Try the next path
+            }
+        }
+        return null;
+    }
+
+    /**
+     * Hashes the Fyr, C and header files of a package.
+     */
+    private static hashSourceDirectory(dir: string): string {
+        let hash = createHash("md5");
+        for(let f of fs.readdirSync(dir).sort()) {
+            if (/\.(fyr|c|h)$/.test(f)) {
+                hash.update(f);
+                hash.update(fs.readFileSync(path.join(dir, f)));
+            }
+        }
+        return hash.digest("hex");
+    }
+
+    /**
+     * Returns all packages of the build, including the compiler-builtin ones.
+     */
+    public static getPackages(): Array<Package> {
+        return Package.packages;
+    }
+
     public static getFyrPaths(): Array<string> {
         if (Package.fyrPaths) {
             return Package.fyrPaths;
@@ -493,6 +1083,10 @@ export class Package {
 
         if (Package.packagesByPath.has(pkgPath)) {
             let p = Package.packagesByPath.get(pkgPath);
+            if (p.stale) {
+                p.reload();
+                return p;
+            }
             if (p.typeCheckPass == 0) {
                 throw new ImportError("Cyclic import", loc, pkgPath);
             }
@@ -520,6 +1114,26 @@ export class Package {
         throw new ImportError("Unknown package \"" + pkgPath + "\"", loc, pkgPath);
     }
 
+    /**
+     * Returns all packages such that each package follows the packages it imports.
+     */
+    private static importOrder(): Array<Package> {
+        let order: Array<Package> = [];
+        let visited = new Set<Package>();
+        let visit = (p: Package) => {
+            if (visited.has(p)) {
+                return;
+            }
+            visited.add(p);
+            for(let i of p.imports) {
+                visit(i);
+            }
+            order.push(p);
+        };
+        Package.packages.forEach(visit);
+        return order.filter((p) => Package.packages.indexOf(p) != -1);
+    }
+
     // Used for system defined packages
     public static registerPackage(p: Package) {
         Package.packagesByPath.set(p.pkgPath, p);
@@ -550,11 +1164,37 @@ export class Package {
     public isImported: boolean;
     public hasMain: boolean;
     public hasInitFunction: boolean;
+    // True if the header of the package contains code, e.g. template instantiations or destructors
+    public hasDuplicateCode: boolean;
+    // Packages used by the typechecker or the code generator of this package
+    public imports: Array<Package> = [];
+    // Copies of small exported functions, which the C backend inlines into importing packages.
+    // Maps the C name of the function to its 'define' node. If the package is up to date, they are restored from its manifest.
+    public inlineBodies: Map<string, ssa.Node> = new Map<string, ssa.Node>();
 
     public compileCmdLineArgs: Array<string>;
     public linkCmdLineArgs: Array<string>;
+    // Set by `config { stacksize: <bytes> }`. Only the setting of the main package is taken into account.
+    // Zero selects the default stack size of the runtime.
+    public stackSize: number = 0;
+    // Set by `config { biasedrc: true }`. Only the setting of the main package is taken into account.
+    // Objects are biased towards the thread that allocated them, i.e. only other threads use atomic reference counting.
+    public biasedRC: boolean = false;
 
     private typeCheckPass: number = 0;
+    // Hash over the contents of the Fyr source files
+    private sourceHash: string = "";
+    private inputHashCache: string = null;
+    // The files of the package have changed, see Package.invalidate
+    private stale: boolean = false;
+    // The package has been loaded from its interface, i.e. without the bodies of its functions
+    public fromInterface: boolean = false;
+    // Do not load the package from its interface, because code must be generated for it
+    private forceSources: boolean = false;
+    // The manifest of the previous build or null
+    private manifest: PackageManifest = null;
+    // Maps object files to the hash of the inputs they have been compiled from
+    private objects: {[ofile: string]: string} = {};
 
     /**
      * The package we are generating an executable or library for or null if
@@ -568,6 +1208,59 @@ export class Package {
 }
 
 
+/**
+ * Stored next to the object files of a package.
+ * It allows to skip code generation and compilation of packages whose inputs did not change since the last build.
+ */
+interface PackageManifest {
+    // See Package.inputHash
+    inputHash: string;
+    // Paths of the packages imported by the typechecker or the code generator
+    imports: Array<string>;
+    hasMain: boolean;
+    hasInitFunction: boolean;
+    hasDuplicateCode: boolean;
+    // Maps object files to the hash of the inputs they have been compiled from
+    objects: {[ofile: string]: string};
+    // See Package.inlineBodies
+    inlineBodies: {[name: string]: ssa.EncodedFunction};
+}
+
+let compilerHash: string = null;
+
+/**
+ * Hashes the files of the compiler and the runtime headers included by the generated code.
+ * Rebuilding the compiler or changing the runtime invalidates all manifests.
+ */
+function compilerFingerprint(): string {
+    if (compilerHash) {
+        return compilerHash;
+    }
+    let hash = createHash("md5");
+    let dirs = [__dirname];
+    while (dirs.length != 0) {
+        let dir = dirs.pop();
+        for(let f of fs.readdirSync(dir).sort()) {
+            let p = path.join(dir, f);
+            let stat = fs.statSync(p);
+            if (stat.isDirectory()) {
+                dirs.push(p);
+            } else if (f.length > 3 && f.substr(f.length - 3, 3) == ".js") {
+                hash.update(p + ":" + stat.size + ":" + stat.mtime.getTime());
+            }
+        }
+    }
+    let runtime = path.join(Package.fyrBase, "src", "runtime");
+    for(let f of fs.readdirSync(runtime).sort()) {
+        if (f.length > 2 && f.substr(f.length - 2, 2) == ".h") {
+            hash.update(f);
+            hash.update(fs.readFileSync(path.join(runtime, f)));
+        }
+    }
+    compilerHash = hash.digest("hex");
+    return compilerHash;
+}
+
 function makeMathFunction64(name: string, paramCount: number, call: SystemCalls, tc: TypeChecker): Function {
     var f: Function = new Function();
     f.name = name;
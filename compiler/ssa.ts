@@ -1,7 +1,7 @@
 import {Package} from "./pkg"
 import { ImplementationError } from "./errors";
 
-export type NodeKind = "coroutine" | "resume" | "spawn" | "spawn_indirect" | "promote" | "demote" | "trunc32" | "trunc64" | "convert32_u" | "convert32_s" | "convert64_u" | "convert64_s" | "goto_step" | "goto_step_if" | "step" | "call_begin" | "call_end" | "call_indirect" | "call_indirect_begin" | "define" | "decl_param" | "decl_result" | "decl_var" | "alloc" | "return" | "yield" | "yield_continue" | "block" | "loop" | "end" | "if" | "br" | "br_if" | "copy" | "struct" | "trap" | "load" | "store" | "addr_of" | "call" | "const" | "add" | "sub" | "mul" | "div" | "div_s" | "div_u" | "rem_s" | "rem_u" | "and" | "or" | "xor" | "shl" | "shr_u" | "shr_s" | "rotl" | "rotr" | "eq" | "ne" | "lt_s" | "lt_u" | "le_s" | "le_u" | "gt_s" | "gt_u" | "ge_s" | "ge_u" | "lt" | "gt" | "le" | "ge" | "min" | "max" | "eqz" | "clz" | "ctz" | "popcnt" | "neg" | "abs" | "copysign" | "ceil" | "floor" | "trunc" | "nearest" | "sqrt" | "wrap" | "extend" | "free" | "incref" | "decref" | "alloc_arr" | "free_arr" | "incref_arr" | "decref_arr" | "member" | "set_member" | "len_arr" | "memcpy" | "memmove" | "memcmp" | "len_str" | "table_iface" | "addr_of_func" | "symbol" | "lock" | "lock_arr" | "unlock" | "unlock_arr" | "notnull" | "notnull_ref" | "println" | "arr_to_str" | "move_arr" | "union" | "cmp_ref";
+export type NodeKind = "coroutine" | "resume" | "spawn" | "spawn_indirect" | "promote" | "demote" | "trunc32" | "trunc64" | "convert32_u" | "convert32_s" | "convert64_u" | "convert64_s" | "goto_step" | "goto_step_if" | "step" | "call_begin" | "call_end" | "call_indirect" | "call_indirect_begin" | "define" | "decl_param" | "decl_result" | "decl_var" | "alloc" | "return" | "yield" | "yield_continue" | "block" | "loop" | "end" | "if" | "br" | "br_if" | "copy" | "struct" | "trap" | "load" | "store" | "addr_of" | "call" | "const" | "add" | "sub" | "mul" | "div" | "div_s" | "div_u" | "rem_s" | "rem_u" | "and" | "or" | "xor" | "shl" | "shr_u" | "shr_s" | "rotl" | "rotr" | "eq" | "ne" | "lt_s" | "lt_u" | "le_s" | "le_u" | "gt_s" | "gt_u" | "ge_s" | "ge_u" | "lt" | "gt" | "le" | "ge" | "min" | "max" | "eqz" | "clz" | "ctz" | "popcnt" | "neg" | "abs" | "copysign" | "ceil" | "floor" | "trunc" | "nearest" | "sqrt" | "wrap" | "extend" | "free" | "incref" | "decref" | "alloc_arr" | "alloc_str" | "free_arr" | "incref_arr" | "decref_arr" | "member" | "set_member" | "len_arr" | "memcpy" | "memmove" | "memcmp" | "eq_str" | "len_str" | "table_iface" | "addr_of_func" | "symbol" | "lock" | "lock_arr" | "unlock" | "unlock_arr" | "notnull" | "notnull_ref" | "println" | "arr_to_str" | "move_arr" | "union" | "cmp_ref";
 export type Type = "i8" | "i16" | "i32" | "i64" | "s8" | "s16" | "s32" | "s64" | "addr" | "f32" | "f64" | "ptr" | "int" | "sint";
 
 export var intSize = 4;
@@ -911,6 +911,52 @@ export class Builder {
     private _current: Node;
 }
 
+/**
+ * Facts about a function, which Optimizer.removeBoundsChecks() uses to analyze one of its loops.
+ */
+interface LoopInfo {
+    // Position of each node in the function
+    index: Map<Node, number>;
+    // All nodes assigning to or modifying a variable
+    writes: Map<Variable, Array<Node>>;
+    globals: Set<Variable>;
+    inLoop: (n: Node) => boolean;
+}
+
+/**
+ * A function body as stored in the manifest of a package, see Optimizer.encodeFunction().
+ * Nodes and variables refer to each other by their position in 'nodes' and 'vars'.
+ */
+export interface EncodedFunction {
+    vars: Array<EncodedVariable>;
+    nodes: Array<EncodedNode>;
+}
+
+interface EncodedVariable {
+    name?: string;
+    type: Type;
+    readCount: number;
+    writeCount: number;
+    isConstant?: boolean;
+    constantValue?: number | string;
+    needsRefCounting?: boolean;
+}
+
+interface EncodedNode {
+    kind: NodeKind;
+    // A function type is encoded as the types of its parameters followed by the type of its result
+    type?: Type | Array<Type>;
+    name?: string;
+    assign?: number;
+    assignType?: Type;
+    // A variable is encoded as [index], numbers which JSON cannot represent as strings
+    args: Array<number | string | [number]>;
+    next: Array<number>;
+    prev: Array<number>;
+    blockPartner?: number;
+    isAsync?: boolean;
+}
+
 export class Optimizer {
     public optimizeConstants(n: Node) {
         this._optimizeConstants(n, n.blockPartner);
@@ -919,6 +965,7 @@ export class Optimizer {
     /**
      * Removes all 'const' nodes which assign to variables that are SSA.
      * Those variables are marked with isConstant.
+     * Computations on constants are folded and arithmetic with one constant argument is simplified.
      */
     private _optimizeConstants(start: Node, end: Node) {
         let n = start;
@@ -944,12 +991,353 @@ export class Optimizer {
                         a.readCount--;
                     }
                 }
+                // A folded node becomes a 'copy' of a constant. Look at it again, because its variable might become a constant as well.
+                if (n.assign && (this.foldConstants(n) || this.simplifyAlgebraic(n))) {
+                    continue;
+                }
                 n = n.next[0];
             }
-            // TODO: Computations on constants can be optimized
         }
     }
 
+    /**
+     * Computes the result of arithmetic, comparison, shift and conversion nodes with constant arguments
+     * and turns the node into a 'copy' of the result.
+     * Nothing is folded if the result would differ from the computation at runtime, e.g. due to precision,
+     * overflow of 64-bit values or division by zero.
+     */
+    private foldConstants(n: Node): boolean {
+        if (typeof(n.type) != "string" || typeof(n.assign.type) != "string" || n.args.length == 0 || !n.args.every((a) => typeof(a) == "number")) {
+            return false;
+        }
+        let t = n.type as Type;
+        // The argument of trunc32 and trunc64 is a float, while the node type is the integer type of the result
+        let isTrunc = n.kind == "trunc32" || n.kind == "trunc64";
+        let a = isTrunc ? n.args[0] as number : Optimizer.normalizeConstant(n.args[0] as number, t);
+        let b = n.args.length > 1 ? Optimizer.normalizeConstant(n.args[1] as number, t) : 0;
+        if (a === null || b === null) {
+            return false;
+        }
+        // Comparisons are emitted with operands wider than the node type, e.g. 'gt_u i8' on 'sint' indices.
+        // The backends compare the operands by their own type. Hence, a constant must not change by normalizing it.
+        // Unsigned comparisons of negative constants depend on the unknown size of the operand.
+        if (Optimizer.compareKinds.has(n.kind) && (a !== n.args[0] || b !== (n.args.length > 1 ? n.args[1] : 0) || (n.kind.substr(-2) == "_u" && (a < 0 || b < 0)))) {
+            return false;
+        }
+        let isFloat = t == "f32" || t == "f64";
+        let size = sizeOf(t);
+        // Bit operations on 64-bit values are computed with 32 bits. This works for sign-extended 32-bit values only.
+        let small = size < 8 || (Optimizer.isInt32(a) && Optimizer.isInt32(b));
+        let result: number;
+        switch (n.kind) {
+            case "add":
+                result = a + b;
+                break;
+            case "sub":
+                result = a - b;
+                break;
+            case "mul":
+                result = isFloat || size == 8 ? a * b : Math.imul(a, b);
+                break;
+            case "div":
+                if (!isFloat) {
+                    return false;
+                }
+                result = a / b;
+                break;
+            case "div_s":
+            case "div_u":
+                if (isFloat || b == 0 || !small || Optimizer.isSignedOverflow(n.kind, a, b, size)) {
+                    return false;
+                }
+                result = Math.trunc(a / b);
+                break;
+            case "rem_s":
+            case "rem_u":
+                if (isFloat || b == 0 || !small || Optimizer.isSignedOverflow(n.kind, a, b, size)) {
+                    return false;
+                }
+                result = a % b;
+                break;
+            case "and":
+            case "or":
+            case "xor":
+                if (isFloat || !small) {
+                    return false;
+                }
+                result = n.kind == "and" ? a & b : (n.kind == "or" ? a | b : a ^ b);
+                break;
+            case "shl":
+            case "shr_s":
+            case "shr_u":
+                if (isFloat || b < 0 || b >= size * 8 || (n.kind == "shr_u" && a < 0)) {
+                    return false;
+                }
+                if (n.kind == "shl") {
+                    result = a * Math.pow(2, b);
+                } else {
+                    // An arithmetic right shift rounds towards negative infinity
+                    result = Math.floor(a / Math.pow(2, b));
+                }
+                break;
+            case "eq":
+                result = a == b ? 1 : 0;
+                break;
+            case "ne":
+                result = a != b ? 1 : 0;
+                break;
+            case "lt_s":
+            case "lt_u":
+            case "lt":
+                result = a < b ? 1 : 0;
+                break;
+            case "le_s":
+            case "le_u":
+            case "le":
+                result = a <= b ? 1 : 0;
+                break;
+            case "gt_s":
+            case "gt_u":
+            case "gt":
+                result = a > b ? 1 : 0;
+                break;
+            case "ge_s":
+            case "ge_u":
+            case "ge":
+                result = a >= b ? 1 : 0;
+                break;
+            case "eqz":
+                result = a == 0 ? 1 : 0;
+                break;
+            case "min":
+                result = Math.min(a, b);
+                break;
+            case "max":
+                result = Math.max(a, b);
+                break;
+            case "neg":
+                result = -a;
+                break;
+            case "abs":
+                result = Math.abs(a);
+                break;
+            case "ceil":
+                result = Math.ceil(a);
+                break;
+            case "floor":
+                result = Math.floor(a);
+                break;
+            case "trunc":
+                result = Math.trunc(a);
+                break;
+            case "sqrt":
+                result = Math.sqrt(a);
+                break;
+            case "clz":
+                if (size != 4) {
+                    return false;
+                }
+                result = Math.clz32(a);
+                break;
+            case "ctz":
+                if (size != 4) {
+                    return false;
+                }
+                result = a == 0 ? 32 : 31 - Math.clz32(a & -a);
+                break;
+            case "popcnt":
+                if (size != 4) {
+                    return false;
+                }
+                result = 0;
+                for(let x = a >>> 0; x != 0; x = x >>> 1) {
+                    result += x & 1;
+                }
+                break;
+            case "trunc32":
+            case "trunc64":
+                result = Math.trunc(a);
+                // Out of range values trap in WASM and are undefined in C
+                if (Optimizer.normalizeConstant(result, t) !== result) {
+                    return false;
+                }
+                break;
+            // The node type is the float type of the result
+            case "convert32_s":
+            case "convert32_u":
+            case "convert64_s":
+            case "convert64_u":
+            case "promote":
+            case "demote":
+                result = n.args[0] as number;
+                if ((n.kind == "convert32_u" && result < 0) || (n.kind == "convert64_u" && result < 0)) {
+                    result = n.kind == "convert32_u" ? result >>> 0 : NaN;
+                }
+                break;
+            // The node type is the integer type of the argument, the variable has the type of the result
+            case "wrap":
+            case "extend":
+                result = a;
+                break;
+            default:
+                return false;
+        }
+        result = Optimizer.normalizeConstant(result, n.assign.type as Type);
+        if (result === null) {
+            return false;
+        }
+        n.kind = "copy";
+        n.type = n.assign.type;
+        n.args = [result];
+        return true;
+    }
+
+    /**
+     * Applies algebraic identities and strength reduction to integer arithmetic with one constant argument,
+     * e.g. x + 0 becomes a copy of x and x * 8 becomes x << 3.
+     */
+    private simplifyAlgebraic(n: Node): boolean {
+        if (n.args.length != 2 || typeof(n.type) != "string" || n.type == "f32" || n.type == "f64") {
+            return false;
+        }
+        let [x, y] = n.args;
+        // Move the constant of commutative operations to the right
+        if (typeof(x) == "number" && y instanceof Variable && (n.kind == "add" || n.kind == "mul" || n.kind == "and" || n.kind == "or" || n.kind == "xor")) {
+            [x, y] = [y, x];
+        }
+        if (!(x instanceof Variable)) {
+            return false;
+        }
+        if (y === x) {
+            switch (n.kind) {
+                case "sub":
+                case "xor":
+                    x.readCount -= 2;
+                    return this.replaceWithCopy(n, 0);
+                case "and":
+                case "or":
+                    x.readCount--;
+                    return this.replaceWithCopy(n, x);
+            }
+            return false;
+        }
+        if (typeof(y) != "number") {
+            return false;
+        }
+        let c = y as number;
+        switch (n.kind) {
+            case "add":
+            case "sub":
+            case "or":
+            case "xor":
+            case "shl":
+            case "shr_s":
+            case "shr_u":
+                if (c == 0) {
+                    return this.replaceWithCopy(n, x);
+                }
+                break;
+            case "mul":
+                if (c == 0) {
+                    x.readCount--;
+                    return this.replaceWithCopy(n, 0);
+                } else if (c == 1) {
+                    return this.replaceWithCopy(n, x);
+                } else if (Optimizer.log2(c) > 0) {
+                    n.kind = "shl";
+                    n.args = [x, Optimizer.log2(c)];
+                    return true;
+                }
+                break;
+            case "and":
+                if (c == 0) {
+                    x.readCount--;
+                    return this.replaceWithCopy(n, 0);
+                }
+                break;
+            case "div_s":
+            case "div_u":
+                if (c == 1) {
+                    return this.replaceWithCopy(n, x);
+                } else if (n.kind == "div_u" && Optimizer.log2(c) > 0) {
+                    n.kind = "shr_u";
+                    n.args = [x, Optimizer.log2(c)];
+                    return true;
+                }
+                break;
+            case "rem_u":
+                if (Optimizer.log2(c) >= 0 && c - 1 <= 0x7fffffff) {
+                    n.kind = "and";
+                    n.args = [x, c - 1];
+                    return true;
+                }
+                break;
+        }
+        return false;
+    }
+
+    private replaceWithCopy(n: Node, value: Variable | number): boolean {
+        n.kind = "copy";
+        n.type = n.assign.type;
+        n.args = [value];
+        return true;
+    }
+
+    /**
+     * Returns the value of the constant 'v' as it is represented by a variable of type 't',
+     * i.e. integers are truncated to the size of the type, and floats are rounded to single precision for f32.
+     * Returns null if the value cannot be represented exactly.
+     */
+    private static normalizeConstant(v: number, t: Type): number | null {
+        if (!isFinite(v)) {
+            return null;
+        }
+        if (t == "f64") {
+            return v;
+        }
+        if (t == "f32") {
+            v = Math.fround(v);
+            return isFinite(v) ? v : null;
+        }
+        if (v != Math.trunc(v)) {
+            return null;
+        }
+        let signed = isSigned(t) || t == "sint";
+        switch (sizeOf(t)) {
+            case 1:
+                return signed ? (v << 24) >> 24 : v & 0xff;
+            case 2:
+                return signed ? (v << 16) >> 16 : v & 0xffff;
+            case 4:
+                return signed ? v | 0 : v >>> 0;
+        }
+        // 64-bit values cannot be truncated with 53 bits of precision
+        return Number.isSafeInteger(v) && (signed || v >= 0) ? v : null;
+    }
+
+    /**
+     * Returns true if the signed division of the smallest value of a type by -1 is computed.
+     * The result does not fit the type. It traps in WASM and is undefined in C.
+     */
+    private static isSignedOverflow(kind: string, a: number, b: number, size: number): boolean {
+        return (kind == "div_s" || kind == "rem_s") && b == -1 && a == -Math.pow(2, size * 8 - 1);
+    }
+
+    private static isInt32(v: number): boolean {
+        return v >= -0x80000000 && v <= 0x7fffffff;
+    }
+
+    /**
+     * Returns k if 'v' is 2^k and -1 otherwise.
+     */
+    private static log2(v: number): number {
+        if (v <= 0 || v > Number.MAX_SAFE_INTEGER || v != Math.trunc(v)) {
+            return -1;
+        }
+        let k = Math.log2(v);
+        return k == Math.trunc(k) ? k : -1;
+    }
+
     public removeDeadCode(n: Node) {
         this._removeDeadCode1(n.blockPartner, n);
         this._removeDeadCode2(n, n.blockPartner);
@@ -1087,6 +1475,982 @@ export class Optimizer {
         }
     }
 
+    /**
+     * Removes pairs of incref/decref and lock/unlock on the same pointer if no node between them
+     * can release memory or run other code, e.g. a call or a decref of another pointer.
+     * The object cannot be destructed in between and the pair does not change the counters of the object.
+     * The second node of a pair must be reached on all paths, hence the search does not leave
+     * the block in which the first node is located.
+     */
+    public removeRedundantRefCounting(n: Node) {
+        this._removeRedundantRefCounting(n.next[0], n.blockPartner);
+    }
+
+    private _removeRedundantRefCounting(start: Node, end: Node) {
+        for(let n = start; n && n != end; ) {
+            if (n.kind == "if") {
+                this._removeRedundantRefCounting(n.next[0], n.blockPartner);
+                if (n.next[1]) {
+                    this._removeRedundantRefCounting(n.next[1], n.blockPartner);
+                }
+                n = n.blockPartner.next[0];
+                continue;
+            } else if (n.kind == "block" || n.kind == "loop") {
+                this._removeRedundantRefCounting(n.next[0], n.blockPartner);
+                n = n.blockPartner.next[0];
+                continue;
+            }
+            let release = Optimizer.releaseKind.get(n.kind);
+            if (release && n.args[0] instanceof Variable) {
+                let r = this.findRelease(n, release);
+                if (r) {
+                    let next = n.next[0] == r ? r.next[0] : n.next[0];
+                    this.removeDeadNode(r);
+                    Node.removeNode(r);
+                    if (n.assign && n.assign.readCount > 0) {
+                        // incref returns its argument
+                        n.kind = "copy";
+                    } else {
+                        this.removeDeadNode(n);
+                        Node.removeNode(n);
+                    }
+                    n = next;
+                    continue;
+                }
+            }
+            n = n.next[0];
+        }
+    }
+
+    /**
+     * Returns the node that undoes the incref or lock node `acquire`, or null if the pair cannot be removed.
+     */
+    private findRelease(acquire: Node, release: NodeKind): Node {
+        // The pointer passed to incref or lock and the pointer returned by it
+        let ptrs: Array<Variable> = [acquire.args[0] as Variable];
+        if (acquire.assign) {
+            ptrs.push(acquire.assign);
+        }
+        for(let n = acquire.next[0]; n; ) {
+            if (n.kind == release && ptrs.indexOf(n.args[0] as Variable) != -1) {
+                return n;
+            }
+            if (n.kind == "if" || n.kind == "block" || n.kind == "loop") {
+                if (!this.isTransparent(n.next[0], n.blockPartner, ptrs) || (n.next[1] && !this.isTransparent(n.next[1], n.blockPartner, ptrs))) {
+                    return null;
+                }
+                n = n.blockPartner.next[0];
+                continue;
+            }
+            if (n.kind == "end" || this.mayRelease(n) || (n.assign && ptrs.indexOf(n.assign) != -1)) {
+                return null;
+            }
+            n = n.next[0];
+        }
+        return null;
+    }
+
+    /**
+     * Returns true if the nodes from `start` up to `end` neither release memory nor branch out of the block
+     * nor assign to one of `ptrs`.
+     */
+    private isTransparent(start: Node, end: Node, ptrs: Array<Variable>): boolean {
+        for(let n = start; n && n != end; ) {
+            if (n.kind == "if" || n.kind == "block" || n.kind == "loop") {
+                if (!this.isTransparent(n.next[0], n.blockPartner, ptrs) || (n.next[1] && !this.isTransparent(n.next[1], n.blockPartner, ptrs))) {
+                    return false;
+                }
+                n = n.blockPartner.next[0];
+                continue;
+            }
+            if (this.mayRelease(n) || (n.assign && ptrs.indexOf(n.assign) != -1)) {
+                return false;
+            }
+            n = n.next[0];
+        }
+        return true;
+    }
+
+    /**
+     * Turns heap allocations of objects that do not escape the function into stack variables.
+     * An object does not escape if the pointer returned by 'alloc' is only used to load from and store to the object,
+     * to check it for null, and to free it without a destructor.
+     * The object is stored in a variable with needsRefCounting, such that it has the same header as a heap object.
+     * The 'free' and null checks are removed, because the memory is released when the function returns.
+     */
+    public allocateOnStack(n: Node) {
+        let allocs: Array<Node> = [];
+        let uses = new Map<Variable, Array<Node>>();
+        this.collectAllocs(n.next[0], n.blockPartner, allocs, uses);
+        for(let alloc of allocs) {
+            let ptr = alloc.assign;
+            let ptrUses = uses.get(ptr) || [];
+            if (ptr.writeCount != 1 || ptr.addressable || !ptrUses.every((u) => this.isNonEscapingUse(u, ptr))) {
+                continue;
+            }
+            for(let u of ptrUses) {
+                if (u.kind == "free" || u.kind == "notnull" || u.kind == "notnull_ref") {
+                    this.removeDeadNode(u);
+                    Node.removeNode(u);
+                }
+            }
+            let t = new StructType();
+            // The object might contain 64-bit values. Hence, it is aligned like an i64.
+            t.addField("data", "i64", Math.ceil((alloc.args[0] as number) / 8));
+            let v = new Variable();
+            v.type = t;
+            v.needsRefCounting = true;
+            v.addressable = true;
+            v.writeCount = 1;
+            v.readCount = 1;
+            // Zero the object like fyr_alloc
+            Node.insertBetween(alloc.prev[0], alloc, new Node(v, "struct", t, [0]));
+            alloc.kind = "addr_of";
+            alloc.args = [v];
+        }
+    }
+
+    private collectAllocs(start: Node, end: Node, allocs: Array<Node>, uses: Map<Variable, Array<Node>>) {
+        for(let n = start; n && n != end; ) {
+            if (n.kind == "alloc" && n.assign && typeof(n.args[0]) == "number" && (n.args[0] as number) <= Optimizer.maxStackAlloc) {
+                allocs.push(n);
+            }
+            this.collectUses(n, n, uses);
+            if (n.kind == "if" && n.next.length > 1) {
+                this.collectAllocs(n.next[1], n.blockPartner, allocs, uses);
+            }
+            n = n.next[0];
+        }
+    }
+
+    /**
+     * Records `n` as a use of all variables in its arguments. `user` is the top-level node containing `n`.
+     */
+    private collectUses(n: Node, user: Node, uses: Map<Variable, Array<Node>>) {
+        for(let a of n.args) {
+            if (a instanceof Variable) {
+                if (!uses.has(a)) {
+                    uses.set(a, []);
+                }
+                uses.get(a).push(user);
+            } else if (a instanceof Node) {
+                // Nested expressions are treated as escaping uses
+                this.collectUses(a, null, uses);
+            }
+        }
+    }
+
+    private isNonEscapingUse(n: Node, ptr: Variable): boolean {
+        if (!n) {
+            return false;
+        }
+        switch (n.kind) {
+            case "load":
+                return true;
+            case "store":
+                // Storing the pointer itself lets it escape
+                return n.args[0] == ptr && n.args[2] != ptr;
+            case "notnull":
+            case "notnull_ref":
+                return true;
+            case "free":
+                // A destructor might let pointers to the object escape
+                return n.args[0] == ptr && n.args[1] === -1;
+        }
+        return false;
+    }
+
+    /**
+     * Removes bounds checks on loop counters which are proven to be in range.
+     * A bounds check is an 'if' that executes 'trap' when 'ge_u i, len' holds.
+     * It is redundant inside a loop that starts with 'br_if' on 'i < n' or 'i == n' (and 'i' starting at 0),
+     * if 'i' is only initialized with a non-negative constant before the loop and incremented by 1 at its end,
+     * and if 'len' is a constant not smaller than 'n' or the same value as 'n'.
+     * Two values are the same if they are computed by the same 'member' nodes from a local variable
+     * that is not assigned inside the loop.
+     * 'globals' are the global variables, which might be modified by functions called in the loop.
+     */
+    public removeBoundsChecks(n: Node, globals: Array<Variable>) {
+        let nodes: Array<Node> = [];
+        this.collectNodes(n, n.blockPartner, nodes);
+        let index = new Map<Node, number>();
+        let writes = new Map<Variable, Array<Node>>();
+        for(let i = 0; i < nodes.length; i++) {
+            let x = nodes[i];
+            index.set(x, i);
+            if (x.assign && x.kind != "decl_var") {
+                if (!writes.has(x.assign)) {
+                    writes.set(x.assign, []);
+                }
+                writes.get(x.assign).push(x);
+            }
+        }
+        // 'set_member' modifies its struct argument, which might be a 'member' of another struct
+        for(let x of nodes) {
+            let v = x.kind == "set_member" ? x.args[0] : null;
+            while (v instanceof Variable) {
+                if (!writes.has(v)) {
+                    writes.set(v, []);
+                }
+                let w = writes.get(v);
+                let d = w.length == 1 && w[0].kind == "member" ? w[0] : null;
+                w.push(x);
+                v = d ? d.args[0] : null;
+            }
+        }
+        let globalSet = new Set<Variable>(globals);
+        for(let loop of nodes) {
+            if (loop.kind != "loop") {
+                continue;
+            }
+            let start = index.get(loop);
+            let end = index.get(loop.blockPartner);
+            this.removeBoundsChecksInLoop(loop, nodes, {
+                index: index,
+                writes: writes,
+                globals: globalSet,
+                inLoop: (x: Node) => index.get(x) > start && index.get(x) < end
+            });
+        }
+    }
+
+    private removeBoundsChecksInLoop(loop: Node, nodes: Array<Node>, info: LoopInfo) {
+        let outer = loop.prev[0];
+        let loopEnd = loop.blockPartner;
+        if (!outer || outer.kind != "block" || loopEnd.prev.length != 1) {
+            return;
+        }
+        // The loop condition is computed before anything else in the loop
+        let guard = loop.next[0];
+        while (guard && guard.kind != "br_if" && !Optimizer.controlKinds.has(guard.kind) && !Optimizer.releasingKinds.has(guard.kind)) {
+            guard = guard.next[0];
+        }
+        if (!guard || guard.kind != "br_if" || guard.blockPartner != outer) {
+            return;
+        }
+        let counter: Node | Variable | number;
+        let limit: Node | Variable | number;
+        let startsAtZero = false;
+        let cond = this.definition(guard.args[0], info);
+        if (cond && cond.kind == "eqz") {
+            // Exit if !(i < n)
+            let cmp = this.definition(cond.args[0], info);
+            if (!cmp || (cmp.kind != "lt_s" && cmp.kind != "lt_u")) {
+                return;
+            }
+            [counter, limit] = cmp.args;
+        } else if (cond && cond.kind == "eq") {
+            // Exit if i == n, where i counts up from 0
+            [counter, limit] = cond.args;
+            startsAtZero = true;
+        } else {
+            return;
+        }
+        // A negative limit is a large number for unsigned comparisons.
+        // If the limit is a variable, it is compared with the same unsigned comparison as 'i'.
+        if (typeof(limit) == "number" && limit < 0) {
+            return;
+        }
+        if (!(counter instanceof Variable) || counter.addressable || info.globals.has(counter) || !this.isLoopInvariant(limit, info)) {
+            return;
+        }
+        let i = counter;
+        // 'i' is assigned exactly twice: initialized before the loop and incremented right before jumping to the start of the loop
+        let w = info.writes.get(i) || [];
+        let br = loopEnd.prev[0];
+        let increment = br.prev[0];
+        if (w.length != 2 || br.kind != "br" || br.blockPartner != loop || !increment || w.indexOf(increment) == -1 ||
+            increment.kind != "add" || increment.args[0] != i || increment.args[1] !== 1) {
+            return;
+        }
+        let init = w[0] == increment ? w[1] : w[0];
+        if ((init.kind != "const" && init.kind != "copy") || typeof(init.args[0]) != "number" || (init.args[0] as number) < 0 ||
+            (startsAtZero && init.args[0] !== 0) || !this.precedesOnSameLevel(init, outer)) {
+            return;
+        }
+        // Within the loop, 0 <= i < limit holds between the loop condition and the increment
+        let first = info.index.get(guard);
+        let last = info.index.get(increment);
+        for(let k = first + 1; k < last; k++) {
+            let check = nodes[k];
+            if (check.kind != "if" || check.next.length != 1 || check.next[0].kind != "trap" || check.next[0].next[0] != check.blockPartner || check.blockPartner.prev.length != 1) {
+                continue;
+            }
+            let c = check.args[0];
+            let cmp = this.definition(c, info);
+            if (!cmp || cmp.kind != "ge_u" || cmp.args[0] != i || info.index.get(cmp) <= first || info.index.get(cmp) >= k) {
+                continue;
+            }
+            let len = cmp.args[1];
+            if (typeof(limit) == "number" ? typeof(len) != "number" || limit > len : !this.isSameValue(limit, len, info)) {
+                continue;
+            }
+            // Unlink 'if', 'trap' and 'end'
+            let prev = check.prev[0];
+            let next = check.blockPartner.next[0];
+            prev.next[prev.next.indexOf(check)] = next;
+            next.prev[next.prev.indexOf(check.blockPartner)] = prev;
+            (c as Variable).readCount--;
+        }
+    }
+
+    private collectNodes(start: Node, end: Node, nodes: Array<Node>) {
+        for(let n = start; n && n != end; n = n.next[0]) {
+            nodes.push(n);
+            if (n.kind == "if" && n.next.length > 1) {
+                this.collectNodes(n.next[1], n.blockPartner, nodes);
+            }
+        }
+    }
+
+    /**
+     * Returns the node assigning to 'v' if 'v' is assigned exactly once.
+     */
+    private definition(v: Variable | number | Node, info: LoopInfo): Node {
+        let w = v instanceof Variable ? info.writes.get(v) : null;
+        return w && w.length == 1 ? w[0] : null;
+    }
+
+    /**
+     * Returns true if 'n' is executed before 'block' whenever 'block' is executed,
+     * i.e. 'n' is found by walking backwards from 'block' without entering or leaving a block.
+     */
+    private precedesOnSameLevel(n: Node, block: Node): boolean {
+        for(let x = block.prev[0]; x; x = x.prev[0]) {
+            if (x == n) {
+                return true;
+            }
+            if (x.kind == "end") {
+                x = x.blockPartner;
+            } else if (x.kind == "block" || x.kind == "loop" || x.kind == "if") {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Returns true if 'v' has the same value whenever it is used in the loop, i.e. it is a constant,
+     * a local variable which is not assigned in the loop, or computed via 'member' from such a variable.
+     */
+    private isLoopInvariant(v: Variable | number | Node, info: LoopInfo): boolean {
+        if (typeof(v) == "number") {
+            return true;
+        }
+        if (!(v instanceof Variable) || v.addressable || info.globals.has(v)) {
+            return false;
+        }
+        if ((info.writes.get(v) || []).every((x) => !info.inLoop(x))) {
+            return true;
+        }
+        let d = this.definition(v, info);
+        return !!d && d.kind == "member" && this.isLoopInvariant(d.args[0], info);
+    }
+
+    private isSameValue(a: Variable | number | Node, b: Variable | number | Node, info: LoopInfo): boolean {
+        a = this.resolveCopy(a, info);
+        b = this.resolveCopy(b, info);
+        if (a === b) {
+            return this.isLoopInvariant(a, info);
+        }
+        let da = this.definition(a, info);
+        let db = this.definition(b, info);
+        if (!da || !db || da.kind != "member" || db.kind != "member" || da.type != db.type || da.args[1] !== db.args[1]) {
+            return false;
+        }
+        return this.isSameValue(da.args[0], db.args[0], info);
+    }
+
+    /**
+     * Returns the local variable of which 'v' is a copy, if that variable is assigned only once.
+     */
+    private resolveCopy(v: Variable | number | Node, info: LoopInfo): Variable | number | Node {
+        for(let d = this.definition(v, info); d && d.kind == "copy" && d.args[0] instanceof Variable; d = this.definition(v, info)) {
+            let src = d.args[0] as Variable;
+            if (src.addressable || info.globals.has(src) || (info.writes.get(src) || []).length > 1) {
+                break;
+            }
+            v = src;
+        }
+        return v;
+    }
+
+    /**
+     * Removes 'notnull' and 'notnull_ref' checks on local variables which are proven to be non-null.
+     * A variable is non-null after it has been checked, after it has been assigned the result of an allocation
+     * or of 'addr_of', for 'this' and for copies of such variables. The proof holds until the variable is assigned again.
+     * 'notnull_ref' additionally proves that the object has not been destructed, which holds until a node
+     * might release an object, e.g. a call or a decref.
+     * Facts learned inside a block or loop are not used after it. Entering a loop, facts on variables modified in the loop are dropped.
+     * 'globals' are the global variables, which might be modified by functions called in between.
+     */
+    public removeNullChecks(n: Node, globals: Array<Variable>) {
+        this._removeNullChecks(n.next[0], n.blockPartner, new Map<Variable, boolean>(), new Set<Variable>(globals));
+    }
+
+    /**
+     * 'facts' maps each variable which is known to be non-null to true, if the object it points to is known to be alive.
+     */
+    private _removeNullChecks(start: Node, end: Node, facts: Map<Variable, boolean>, globals: Set<Variable>) {
+        for(let n = start; n && n != end; ) {
+            if (n.kind == "if" || n.kind == "block" || n.kind == "loop") {
+                if (n.kind == "loop") {
+                    // The loop can be entered from its end
+                    this.forgetNullChecks(n, facts);
+                }
+                this._removeNullChecks(n.next[0], n.blockPartner, new Map<Variable, boolean>(facts), globals);
+                if (n.kind == "if" && n.next[1]) {
+                    this._removeNullChecks(n.next[1], n.blockPartner, new Map<Variable, boolean>(facts), globals);
+                }
+                // The end of the block can be reached from anywhere inside the block
+                this.forgetNullChecks(n, facts);
+                n = n.blockPartner.next[0];
+                continue;
+            }
+            let next = n.next[0];
+            let v = n.args[0] instanceof Variable ? n.args[0] as Variable : null;
+            if ((n.kind == "notnull" || n.kind == "notnull_ref") && v && !v.addressable && !globals.has(v)) {
+                let alive = n.kind == "notnull_ref";
+                if (facts.has(v) && (!alive || facts.get(v))) {
+                    this.removeDeadNode(n);
+                    Node.removeNode(n);
+                } else {
+                    facts.set(v, alive);
+                }
+                n = next;
+                continue;
+            }
+            if (n.kind == "step") {
+                // Execution can resume here after a 'goto_step' from anywhere
+                facts.clear();
+            } else if (!Optimizer.branchKinds.has(n.kind) && this.mayRelease(n)) {
+                facts.forEach((alive, x) => facts.set(x, false));
+            }
+            if (n.kind == "set_member" && v) {
+                facts.delete(v);
+            }
+            if (n.assign && !n.assign.addressable && !globals.has(n.assign)) {
+                let src = n.kind == "copy" && v ? facts.get(v) : undefined;
+                facts.delete(n.assign);
+                if (n.kind == "alloc" || n.kind == "alloc_arr" || n.kind == "alloc_str") {
+                    facts.set(n.assign, true);
+                } else if (n.kind == "addr_of" || (n.kind == "decl_param" && n.assign.name == "this")) {
+                    facts.set(n.assign, false);
+                } else if (src !== undefined) {
+                    facts.set(n.assign, src);
+                }
+            }
+            n = next;
+        }
+    }
+
+    /**
+     * Drops all facts which might not hold anymore when the block or loop 'n' is entered again or left.
+     */
+    private forgetNullChecks(n: Node, facts: Map<Variable, boolean>) {
+        let nodes: Array<Node> = [];
+        this.collectNodes(n.next[0], n.blockPartner, nodes);
+        if (n.kind == "if" && n.next[1]) {
+            this.collectNodes(n.next[1], n.blockPartner, nodes);
+        }
+        for(let x of nodes) {
+            if (x.kind == "step") {
+                facts.clear();
+                return;
+            }
+            if (!Optimizer.branchKinds.has(x.kind) && this.mayRelease(x)) {
+                facts.forEach((alive, v) => facts.set(v, false));
+            }
+            if (x.assign) {
+                facts.delete(x.assign);
+            }
+            if (x.kind == "set_member" && x.args[0] instanceof Variable) {
+                facts.delete(x.args[0] as Variable);
+            }
+        }
+    }
+
+    /**
+     * Replaces a computation by a copy of an earlier result, if both compute the same value in the same block.
+     * Nodes in a block are executed in order, except for branches leaving the block. Hence, an earlier node
+     * has been executed whenever a later one is. Results computed before a nested block are not reused after it.
+     * This applies to arithmetic, comparisons and 'member' as long as their arguments are not assigned in between.
+     * 'load' and other nodes reading memory are reused only if no node in between might write to memory,
+     * e.g. a 'store', a call, a decref or an assignment to an addressable variable.
+     * Nodes using addressable variables or 'globals' are not considered, because they can change via pointers or calls.
+     */
+    public eliminateCommonSubexpressions(n: Node, globals: Array<Variable>) {
+        this._eliminateCommonSubexpressions(n.next[0], n.blockPartner, new Set<Variable>(globals), new Map<Variable, number>());
+    }
+
+    private _eliminateCommonSubexpressions(start: Node, end: Node, globals: Set<Variable>, ids: Map<Variable, number>) {
+        // Maps the key of a computation to the variable holding its result
+        let values = new Map<string, Variable>();
+        // The keys of all computations which use a variable as argument or result
+        let uses = new Map<Variable, Array<string>>();
+        // The keys of all computations reading memory
+        let memory: Array<string> = [];
+        for(let n = start; n && n != end; ) {
+            if (n.kind == "if" || n.kind == "block" || n.kind == "loop") {
+                this._eliminateCommonSubexpressions(n.next[0], n.blockPartner, globals, ids);
+                if (n.kind == "if" && n.next[1]) {
+                    this._eliminateCommonSubexpressions(n.next[1], n.blockPartner, globals, ids);
+                }
+                values.clear();
+                n = n.blockPartner.next[0];
+                continue;
+            }
+            if (Optimizer.resumeKinds.has(n.kind) || n.kind == "set_member") {
+                // Other code might have run, or a struct is modified which might be the argument of 'member' nodes
+                values.clear();
+            } else if ((!Optimizer.pureKinds.has(n.kind) && !Optimizer.readingKinds.has(n.kind) && !Optimizer.nonWritingKinds.has(n.kind)) ||
+                    (n.assign && (n.assign.addressable || globals.has(n.assign)))) {
+                // Assigning an addressable variable or a global writes to memory which pointers might read
+                memory.forEach((key) => values.delete(key));
+                memory = [];
+            }
+            let key = this.expressionKey(n, globals, ids);
+            let value = key ? values.get(key) : undefined;
+            if (value && value != n.assign) {
+                for(let a of n.args) {
+                    if (a instanceof Variable) {
+                        a.readCount--;
+                    }
+                }
+                this.replaceWithCopy(n, value);
+                value.readCount++;
+                key = null;
+            }
+            if (n.assign) {
+                (uses.get(n.assign) || []).forEach((key) => values.delete(key));
+                uses.delete(n.assign);
+            }
+            if (key && n.args.indexOf(n.assign) == -1 && !n.assign.addressable && !globals.has(n.assign)) {
+                values.set(key, n.assign);
+                for(let v of [n.assign, ...n.args]) {
+                    if (v instanceof Variable) {
+                        if (!uses.has(v)) {
+                            uses.set(v, []);
+                        }
+                        uses.get(v).push(key);
+                    }
+                }
+                if (Optimizer.readingKinds.has(n.kind)) {
+                    memory.push(key);
+                }
+            }
+            n = n.next[0];
+        }
+    }
+
+    /**
+     * Returns a string which is equal for two nodes computing the same value from the same arguments,
+     * or null if the node cannot be reused.
+     */
+    private expressionKey(n: Node, globals: Set<Variable>, ids: Map<Variable, number>): string {
+        if (!n.assign || (!Optimizer.pureKinds.has(n.kind) && !Optimizer.readingKinds.has(n.kind))) {
+            return null;
+        }
+        let key = n.kind + " " + String(n.type) + " " + String(n.assign.type);
+        for(let a of n.args) {
+            if (a instanceof Variable) {
+                if (a.addressable || globals.has(a) || a.name == "$mem") {
+                    return null;
+                }
+                if (!ids.has(a)) {
+                    ids.set(a, ids.size);
+                }
+                key += " v" + ids.get(a).toString();
+            } else if (typeof(a) == "number") {
+                key += " " + a.toString();
+            } else {
+                return null;
+            }
+        }
+        return key;
+    }
+
+    /**
+     * Returns true if calls to the function 'n' can be replaced by a copy of its body.
+     * The body must be small, it must not call other functions, release objects, yield or loop,
+     * and it may return only at its end. All variables of the body must be parameters, assigned in the body,
+     * constants or one of 'globals'.
+     * If 'globals' is null, the body is inlined by another module, i.e. the package importing the function.
+     * Then it must not use global variables and struct types, which are local to the module.
+     * Its constants must be numbers, because the body is stored in the manifest of the package, see encodeFunction().
+     */
+    public isInlinable(n: Node, globals: Array<Variable> | null): boolean {
+        let t = n.type;
+        if (n.kind != "define" || n.isAsync || !(t instanceof FunctionType) || t.callingConvention != "fyr" ||
+            !t.params.every((p) => this.isInlinableType(p, globals)) || !this.isInlinableType(t.result, globals)) {
+            return false;
+        }
+        let defined = new Set<Variable>(globals || []);
+        // The 'return' node passes the result. A result variable which is assigned by name is not supported.
+        let results = new Set<Variable>();
+        let first = n.next[0];
+        for(; first && (first.kind == "decl_param" || first.kind == "decl_result"); first = first.next[0]) {
+            if (first.kind == "decl_result") {
+                results.add(first.assign);
+                continue;
+            }
+            if (first.assign.addressable || !this.isInlinableType(first.type, globals)) {
+                return false;
+            }
+            defined.add(first.assign);
+        }
+        if (!first) {
+            return false;
+        }
+        let nodes: Array<Node> = [];
+        this.collectNodes(first, n.blockPartner, nodes);
+        let body = new Set<Node>(nodes);
+        let cost = 0;
+        for(let x of nodes) {
+            if (x.kind == "return") {
+                if (x.next[0] != n.blockPartner) {
+                    return false;
+                }
+            } else if (x.kind == "br" || x.kind == "br_if") {
+                if (!body.has(x.blockPartner)) {
+                    return false;
+                }
+            } else if (Optimizer.releasingKinds.has(x.kind) || Optimizer.notInlinableKinds.has(x.kind)) {
+                return false;
+            }
+            if (x.assign && (x.assign.addressable || results.has(x.assign) || !this.isInlinableType(x.assign.type, globals))) {
+                return false;
+            }
+            if (x.kind != "end" && x.kind != "return") {
+                cost++;
+            }
+            if (x.assign) {
+                defined.add(x.assign);
+            }
+        }
+        if (cost > Optimizer.maxInlineCost) {
+            return false;
+        }
+        for(let x of nodes) {
+            if (!(x.type instanceof FunctionType) && !this.isInlinableType(x.type, globals)) {
+                return false;
+            }
+            for(let a of x.args) {
+                if (a instanceof Node) {
+                    return false;
+                }
+                if (a instanceof Variable && !defined.has(a) && a.name != "$mem" && !(a.isConstant && this.isInlinableType(a.type, globals))) {
+                    return false;
+                }
+                if (a instanceof Variable && a.isConstant && !globals && typeof(a.constantValue) != "number") {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    private isInlinableType(t: Type | FunctionType | StructType | PointerType, globals: Array<Variable> | null): boolean {
+        return globals != null || !t || typeof(t) == "string";
+    }
+
+    /**
+     * Replaces calls to the functions in 'bodies' by copies of their bodies.
+     * 'bodies' maps the index of a function, i.e. the first argument of 'call', to its 'define' node,
+     * for which isInlinable() must hold. Hence, the inlined code contains no further calls.
+     * The parameters become variables which are initialized with the arguments of the call.
+     */
+    public inlineCalls(n: Node, bodies: Map<number, Node>) {
+        let nodes: Array<Node> = [];
+        this.collectNodes(n.next[0], n.blockPartner, nodes);
+        for(let c of nodes) {
+            if (c.kind == "call" && typeof(c.args[0]) == "number" && bodies.has(c.args[0] as number)) {
+                this.inlineCall(c, bodies.get(c.args[0] as number));
+            }
+        }
+    }
+
+    private inlineCall(c: Node, f: Node) {
+        let params: Array<Variable> = [];
+        let first = f.next[0];
+        for(; first.kind == "decl_param" || first.kind == "decl_result"; first = first.next[0]) {
+            if (first.kind == "decl_param") {
+                params.push(first.assign);
+            }
+        }
+        let ret: Node = null;
+        let last: Node = null;
+        for(let x = first; x && x != f.blockPartner; x = x.next[0]) {
+            if (x.kind == "return") {
+                ret = x;
+                break;
+            }
+            last = x;
+        }
+        if (params.length != c.args.length - 1 || c.prev.length != 1 || c.next.length != 1 || (c.assign && (!ret || ret.args.length == 0))) {
+            return;
+        }
+        let nodes: Array<Node> = [];
+        if (last) {
+            this.collectNodes(first, last.next[0], nodes);
+        }
+        let vars = this.copyVariables(params, ret ? nodes.concat([ret]) : nodes, false);
+        let clones = this.copyNodes(nodes, vars);
+        let added: Array<Node> = [];
+        for(let i = 0; i < params.length; i++) {
+            let p = new Node(vars.get(params[i]), "copy", params[i].type, [c.args[i + 1] as Variable | number]);
+            Node.insertBetween(c.prev[0], c, p);
+            added.push(p);
+        }
+        if (last) {
+            let prev = c.prev[0];
+            let entry = clones.get(first);
+            let exit = clones.get(last);
+            prev.next[prev.next.indexOf(c)] = entry;
+            entry.prev = [prev];
+            exit.next = [c];
+            c.prev = [exit];
+            clones.forEach((x) => added.push(x));
+        }
+        if (c.assign) {
+            let a = ret.args[0];
+            let r = new Node(c.assign, "copy", (c.type as FunctionType).result, [a instanceof Variable ? vars.get(a) || a : a as number]);
+            Node.insertBetween(c.prev[0], c, r);
+            added.push(r);
+        }
+        // The arguments and the result of the call are now read and written by the copies
+        Node.removeNode(c);
+        let fresh = new Set<Variable>(vars.values());
+        for(let x of added) {
+            if (x.assign && fresh.has(x.assign)) {
+                x.assign.writeCount++;
+            }
+            for(let a of x.args) {
+                if (a instanceof Variable && fresh.has(a)) {
+                    a.readCount++;
+                }
+            }
+        }
+    }
+
+    /**
+     * Returns a copy of the function 'n', which remains unchanged when 'n' is optimized.
+     * All variables of the copy are new, except for global variables.
+     */
+    public copyFunction(n: Node): Node {
+        let nodes: Array<Node> = [];
+        this.collectNodes(n, n.blockPartner, nodes);
+        nodes.push(n.blockPartner);
+        let params = nodes.filter((x) => x.kind == "decl_param").map((x) => x.assign);
+        return this.copyNodes(nodes, this.copyVariables(params, nodes, true)).get(n);
+    }
+
+    /**
+     * Returns a representation of the function 'n' which can be stored as JSON.
+     * isInlinable(n, null) must hold, i.e. all types are basic types and all constants are numbers.
+     */
+    public static encodeFunction(n: Node): EncodedFunction {
+        let nodes: Array<Node> = [];
+        new Optimizer().collectNodes(n, n.blockPartner, nodes);
+        nodes.push(n.blockPartner);
+        let nodeIndex = new Map<Node, number>();
+        nodes.forEach((x, i) => nodeIndex.set(x, i));
+        let vars: Array<EncodedVariable> = [];
+        let varIndex = new Map<Variable, number>();
+        let encodeVar = (v: Variable): number => {
+            if (!varIndex.has(v)) {
+                let e: EncodedVariable = {type: v.type as Type, readCount: v.readCount, writeCount: v.writeCount};
+                if (v.name == "$mem") {
+                    e.name = v.name;
+                }
+                if (v.isConstant) {
+                    e.isConstant = true;
+                    e.constantValue = Optimizer.encodeNumber(v.constantValue as number);
+                }
+                if (v.needsRefCounting) {
+                    e.needsRefCounting = true;
+                }
+                varIndex.set(v, vars.length);
+                vars.push(e);
+            }
+            return varIndex.get(v);
+        };
+        let result = nodes.map((x) => {
+            let e: EncodedNode = {
+                kind: x.kind,
+                args: x.args.map((a) => a instanceof Variable ? [encodeVar(a)] as [number] : Optimizer.encodeNumber(a as number)),
+                next: x.next.map((m) => nodeIndex.get(m)),
+                prev: x.prev.map((m) => nodeIndex.get(m))
+            };
+            if (x.type instanceof FunctionType) {
+                e.type = x.type.params.concat([x.type.result]) as Array<Type>;
+            } else if (x.type) {
+                e.type = x.type as Type;
+            }
+            if (x.name) {
+                e.name = x.name;
+            }
+            if (x.assign) {
+                e.assign = encodeVar(x.assign);
+            }
+            if (x.assignType) {
+                e.assignType = x.assignType as Type;
+            }
+            if (x.blockPartner) {
+                e.blockPartner = nodeIndex.get(x.blockPartner);
+            }
+            if (x.isAsync) {
+                e.isAsync = true;
+            }
+            return e;
+        });
+        return {vars: vars, nodes: result};
+    }
+
+    /**
+     * Restores a function encoded by encodeFunction() and returns its 'define' node.
+     * All variables are new.
+     */
+    public static decodeFunction(f: EncodedFunction): Node {
+        let vars = f.vars.map((e) => {
+            let v = new Variable(e.name);
+            v.type = e.type;
+            v.readCount = e.readCount;
+            v.writeCount = e.writeCount;
+            v.isConstant = !!e.isConstant;
+            if (e.isConstant) {
+                v.constantValue = Optimizer.decodeNumber(e.constantValue);
+            }
+            v.needsRefCounting = !!e.needsRefCounting;
+            return v;
+        });
+        let nodes = f.nodes.map((e) => {
+            let t: Type | FunctionType = Array.isArray(e.type) ? new FunctionType(e.type.slice(0, e.type.length - 1), e.type[e.type.length - 1]) : e.type;
+            let x = new Node(e.assign !== undefined ? vars[e.assign] : null, e.kind, t, []);
+            x.args = e.args.map((a) => Array.isArray(a) ? vars[a[0]] : Optimizer.decodeNumber(a));
+            x.name = e.name;
+            x.assignType = e.assignType;
+            x.isAsync = !!e.isAsync;
+            return x;
+        });
+        f.nodes.forEach((e, i) => {
+            nodes[i].next = e.next.map((k) => nodes[k]);
+            nodes[i].prev = e.prev.map((k) => nodes[k]);
+            nodes[i].blockPartner = e.blockPartner !== undefined ? nodes[e.blockPartner] : undefined;
+        });
+        return nodes[0];
+    }
+
+    // JSON has no representation for NaN, infinity and negative zero
+    private static encodeNumber(v: number): number | string {
+        return isFinite(v) && !Object.is(v, -0) ? v : (Object.is(v, -0) ? "-0" : v.toString());
+    }
+
+    private static decodeNumber(v: number | string): number {
+        return typeof(v) == "string" ? Number(v) : v;
+    }
+
+    /**
+     * Maps the parameters, constants and variables assigned in 'nodes' to new variables.
+     * If 'counts' is true, the new variables are read and written as often as the old ones.
+     */
+    private copyVariables(params: Array<Variable>, nodes: Array<Node>, counts: boolean): Map<Variable, Variable> {
+        let vars = new Map<Variable, Variable>();
+        let copy = (v: Variable) => {
+            if (vars.has(v) || v.name == "$mem") {
+                return;
+            }
+            let x = new Variable();
+            x.type = v.type;
+            x.isConstant = v.isConstant;
+            x.constantValue = v.constantValue;
+            x.needsRefCounting = v.needsRefCounting;
+            if (counts) {
+                x.readCount = v.readCount;
+                x.writeCount = v.writeCount;
+            }
+            vars.set(v, x);
+        };
+        params.forEach(copy);
+        for(let x of nodes) {
+            if (x.assign) {
+                copy(x.assign);
+            }
+            for(let a of x.args) {
+                if (a instanceof Variable && a.isConstant) {
+                    copy(a);
+                }
+            }
+        }
+        return vars;
+    }
+
+    /**
+     * Copies 'nodes' and replaces their variables as given by 'vars'.
+     * The copies are linked like the original nodes. Links to nodes outside of 'nodes' are undefined.
+     */
+    private copyNodes(nodes: Array<Node>, vars: Map<Variable, Variable>): Map<Node, Node> {
+        let clones = new Map<Node, Node>();
+        let mapArg = (a: Variable | number | Node) => a instanceof Variable ? vars.get(a) || a : a;
+        for(let x of nodes) {
+            let y = new Node(x.assign ? vars.get(x.assign) || x.assign : null, x.kind, x.type, []);
+            y.args = x.args.map(mapArg);
+            y.name = x.name;
+            y.assignType = x.assignType;
+            y.isAsync = x.isAsync;
+            clones.set(x, y);
+        }
+        for(let x of nodes) {
+            let y = clones.get(x);
+            y.next = x.next.map((m) => clones.get(m));
+            y.prev = x.prev.map((m) => clones.get(m));
+            y.blockPartner = clones.get(x.blockPartner);
+        }
+        return clones;
+    }
+
+    private mayRelease(n: Node): boolean {
+        if (Optimizer.releasingKinds.has(n.kind)) {
+            return true;
+        }
+        for(let a of n.args) {
+            if (a instanceof Node && this.mayRelease(a)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Objects larger than this number of bytes are not allocated on the stack, since coroutines have small stacks
+    private static maxStackAlloc: number = 256;
+    private static releaseKind: Map<string, NodeKind> = new Map<string, NodeKind>([["incref", "decref"], ["incref_arr", "decref_arr"], ["lock", "unlock"], ["lock_arr", "unlock_arr"]]);
+    // Nodes which open or close a block
+    private static controlKinds: Set<string> = new Set<string>(["block", "loop", "if", "end"]);
+    // Functions with more nodes are not inlined
+    private static maxInlineCost: number = 12;
+    // Nodes which prevent a function from being inlined, in addition to releasingKinds
+    private static notInlinableKinds: Set<string> = new Set<string>(["define", "loop", "decl_result", "decl_var", "addr_of", "addr_of_func", "table_iface", "symbol"]);
+    // Nodes which compute their result from their arguments only
+    private static pureKinds: Set<string> = new Set<string>(["add", "sub", "mul", "and", "or", "xor", "shl", "shr_u", "shr_s", "rotl", "rotr",
+        "eq", "ne", "lt_s", "lt_u", "le_s", "le_u", "gt_s", "gt_u", "ge_s", "ge_u", "lt", "gt", "le", "ge", "min", "max", "eqz", "clz", "ctz", "popcnt",
+        "neg", "abs", "copysign", "ceil", "floor", "trunc", "nearest", "sqrt", "wrap", "extend", "promote", "demote", "member"]);
+    // Nodes which compute their result from their arguments and the memory
+    private static readingKinds: Set<string> = new Set<string>(["load", "len_arr", "len_str", "eq_str", "memcmp", "cmp_ref"]);
+    // Further nodes which do not write to memory that is visible to readingKinds, unless they assign an addressable variable or a global
+    private static nonWritingKinds: Set<string> = new Set<string>(["copy", "const", "struct", "notnull", "notnull_ref", "trap", "addr_of",
+        "alloc", "alloc_arr", "alloc_str", "decl_param", "decl_result", "decl_var", "div", "div_s", "div_u", "rem_s", "rem_u",
+        "trunc32", "trunc64", "convert32_u", "convert32_s", "convert64_u", "convert64_s"]);
+    // Nodes at which execution can continue after other code has run
+    private static resumeKinds: Set<string> = new Set<string>(["step", "goto_step", "goto_step_if", "yield", "yield_continue", "resume", "coroutine"]);
+    // Nodes which compare their arguments
+    private static compareKinds: Set<string> = new Set<string>(["eq", "ne", "eqz", "lt", "lt_s", "lt_u", "le", "le_s", "le_u", "gt", "gt_s", "gt_u", "ge", "ge_s", "ge_u"]);
+    // Nodes which leave the current block without releasing an object
+    private static branchKinds: Set<string> = new Set<string>(["br", "br_if", "br_table", "return"]);
+    // Nodes which might free an object, run arbitrary code or leave the current block
+    private static releasingKinds: Set<string> = new Set<string>(["call", "call_indirect", "call_begin", "call_end", "call_indirect_begin", "spawn", "spawn_indirect",
+        "free", "free_arr", "decref", "decref_arr", "unlock", "unlock_arr", "move_arr", "yield", "yield_continue", "return", "br", "br_if", "br_table",
+        "goto_step", "goto_step_if", "step", "coroutine", "resume"]);
+
     private removeDeadStrain(n: Node, end: Node) {
         for(; n && n != end; ) {
             let n2 = n.next[0];
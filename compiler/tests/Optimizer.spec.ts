@@ -0,0 +1,643 @@
+import { expect } from 'chai'
+
+import { Builder, Optimizer, FunctionType, StructType, Variable, Node, NodeKind } from '../ssa'
+
+describe('Optimizer optimizeConstants()', () => {
+    let optimizer: Optimizer
+
+    before(() => {
+        optimizer = new Optimizer()
+    })
+
+    // Builds a function that traps if the comparison of 'a' and 'b' is true
+    function compare(kind: "gt_s" | "gt_u", a: number, b: number): Variable {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType([], null))
+        let cmp = builder.assign(builder.tmp(), kind, "i8", [a, b])
+        builder.ifBlock(cmp)
+        builder.assign(null, "trap", null, [])
+        builder.end()
+        builder.end()
+        optimizer.optimizeConstants(f)
+        return cmp
+    }
+
+    it('folds comparisons of constants that fit the node type', () => {
+        let cmp = compare("gt_u", 100, 10)
+        expect(cmp.isConstant).to.equal(true)
+        expect(cmp.constantValue).to.equal(1)
+    })
+
+    it('does not truncate a constant index of 256 or more to the node type', () => {
+        expect(compare("gt_u", 256, 10).isConstant).to.not.equal(true)
+        expect(compare("gt_s", 300, 44).isConstant).to.not.equal(true)
+    })
+
+    it('does not fold unsigned comparisons of negative constants', () => {
+        expect(compare("gt_u", -1, 10).isConstant).to.not.equal(true)
+    })
+
+    // Builds a function that computes 'a kind b' with constants and returns the result variable
+    function fold(kind: "div_s" | "rem_s", type: "s8" | "s32", a: number, b: number): Variable {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType([], null))
+        let v = builder.assign(builder.tmp(), kind, type, [a, b])
+        builder.assign(null, "return", type, [v])
+        builder.end()
+        optimizer.optimizeConstants(f)
+        return v
+    }
+
+    it('folds signed division and remainder', () => {
+        expect(fold("div_s", "s32", -7, 2).constantValue).to.equal(-3)
+        expect(fold("rem_s", "s32", -7, 2).constantValue).to.equal(-1)
+        expect(fold("div_s", "s8", -127, -1).constantValue).to.equal(127)
+    })
+
+    it('does not fold the division of the smallest signed value by -1', () => {
+        expect(fold("div_s", "s32", -0x80000000, -1).isConstant).to.not.equal(true)
+        expect(fold("rem_s", "s32", -0x80000000, -1).isConstant).to.not.equal(true)
+        expect(fold("div_s", "s8", -128, -1).isConstant).to.not.equal(true)
+    })
+})
+
+describe('Optimizer simplifyAlgebraic()', () => {
+    let optimizer: Optimizer
+
+    before(() => {
+        optimizer = new Optimizer()
+    })
+
+    // Builds a function that computes 'x kind y' on a parameter 'x' and returns the node computing it.
+    // The node is undefined if it has been replaced by a constant.
+    function simplify(kind: NodeKind, y: number | "x", swap: boolean = false): { node: Node, v: Variable, x: Variable } {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType(["s32"], "s32"))
+        let x = builder.declareParam("s32", "x")
+        let arg = y == "x" ? x : y
+        let v = builder.assign(builder.tmp(), kind, "s32", swap ? [arg, x] : [x, arg])
+        builder.assign(null, "return", "s32", [v])
+        builder.end()
+        optimizer.optimizeConstants(f)
+        let n = f.next[0]
+        while (n && n.assign != v) {
+            n = n.next[0]
+        }
+        return { node: n, v: v, x: x }
+    }
+
+    it('replaces neutral operations with a copy', () => {
+        for (let kind of ["add", "sub", "or", "xor", "shl", "shr_s", "shr_u"] as Array<NodeKind>) {
+            let r = simplify(kind, 0)
+            expect(r.node.kind).to.equal("copy")
+            expect(r.node.args).to.deep.equal([r.x])
+        }
+        expect(simplify("mul", 1).node.kind).to.equal("copy")
+        expect(simplify("div_s", 1).node.kind).to.equal("copy")
+    })
+
+    it('moves the constant of commutative operations to the right', () => {
+        let r = simplify("add", 0, true)
+        expect(r.node.kind).to.equal("copy")
+        expect(r.node.args).to.deep.equal([r.x])
+    })
+
+    it('replaces operations with a constant result and drops the read', () => {
+        let r = simplify("mul", 0)
+        expect(r.v.isConstant).to.equal(true)
+        expect(r.v.constantValue).to.equal(0)
+        expect(r.x.readCount).to.equal(1)
+        expect(simplify("and", 0).v.constantValue).to.equal(0)
+        expect(simplify("sub", "x").v.constantValue).to.equal(0)
+        expect(simplify("xor", "x").v.constantValue).to.equal(0)
+    })
+
+    it('reduces multiplication and unsigned division by powers of two to shifts', () => {
+        let r = simplify("mul", 8)
+        expect(r.node.kind).to.equal("shl")
+        expect(r.node.args).to.deep.equal([r.x, 3])
+        r = simplify("div_u", 16)
+        expect(r.node.kind).to.equal("shr_u")
+        expect(r.node.args).to.deep.equal([r.x, 4])
+        r = simplify("rem_u", 16)
+        expect(r.node.kind).to.equal("and")
+        expect(r.node.args).to.deep.equal([r.x, 15])
+    })
+
+    it('does not reduce signed division or non-powers of two', () => {
+        expect(simplify("div_s", 8).node.kind).to.equal("div_s")
+        expect(simplify("rem_s", 8).node.kind).to.equal("rem_s")
+        expect(simplify("mul", 6).node.kind).to.equal("mul")
+        expect(simplify("div_u", 6).node.kind).to.equal("div_u")
+    })
+})
+
+describe('Optimizer eliminateCommonSubexpressions()', () => {
+    let optimizer: Optimizer
+
+    before(() => {
+        optimizer = new Optimizer()
+    })
+
+    // Builds `let p = &x; let a = *p; x = 2; let b = *p` and returns the node loading 'b'.
+    // Without the assignment to 'x', the second load is a common subexpression.
+    function reload(assignX: boolean): Node {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType([], null))
+        let x = builder.declareVar("sint", "x", false)
+        x.addressable = true
+        builder.assign(x, "copy", "sint", [1])
+        let p = builder.assign(builder.tmp(), "addr_of", "addr", [x])
+        builder.assign(builder.tmp(), "load", "sint", [p, 0])
+        if (assignX) {
+            builder.assign(x, "copy", "sint", [2])
+        }
+        let b = builder.assign(builder.tmp(), "load", "sint", [p, 0])
+        builder.end()
+        optimizer.eliminateCommonSubexpressions(f, [])
+        let n = f.next[0]
+        while (n.assign != b) {
+            n = n.next[0]
+        }
+        return n
+    }
+
+    it('reuses a load if memory is not written in between', () => {
+        expect(reload(false).kind).to.equal("copy")
+    })
+
+    it('reloads after an assignment to an addressable variable', () => {
+        expect(reload(true).kind).to.equal("load")
+    })
+})
+
+describe('Optimizer removeBoundsChecks()', () => {
+    let optimizer: Optimizer
+
+    before(() => {
+        optimizer = new Optimizer()
+    })
+
+    interface LoopOptions {
+        // The loop exits if !(i < n) or if i == n
+        exit?: "lt" | "eq"
+        start?: number
+        // The limit 'n' is a parameter, a constant, or a member of a local struct
+        limit?: "param" | number | "member"
+        // The length checked by the bounds check is the limit or a constant
+        len?: "limit" | number
+        writeCounter?: boolean
+        assignLimit?: boolean
+        setMember?: boolean
+    }
+
+    // Builds `for(i := start; i < n; i++) { if (i >= len) trap }` and returns true if the 'trap' has been removed
+    function removesTrap(o: LoopOptions): boolean {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType(["sint"], null))
+        let param = builder.declareParam("sint", "n")
+        let s = new StructType()
+        s.addField("len", "sint")
+        let sv = builder.declareVar(s, "s", false)
+        let i = builder.declareVar("sint", "i", false)
+        let limit: Variable | number = typeof(o.limit) == "number" ? o.limit : param
+        if (o.limit == "member") {
+            limit = builder.assign(builder.tmp(), "member", "sint", [sv, 0])
+        }
+        builder.assign(i, "copy", "sint", [o.start || 0])
+        let outer = builder.block()
+        let loop = builder.loop()
+        if (o.exit == "eq") {
+            builder.br_if(builder.assign(builder.tmp(), "eq", "i8", [i, limit]), outer)
+        } else {
+            let cmp = builder.assign(builder.tmp(), "lt_s", "i8", [i, limit])
+            builder.br_if(builder.assign(builder.tmp(), "eqz", "i8", [cmp]), outer)
+        }
+        if (o.writeCounter) {
+            builder.assign(i, "copy", "sint", [0])
+        }
+        if (o.assignLimit) {
+            builder.assign(param, "copy", "sint", [0])
+        }
+        if (o.setMember) {
+            builder.assign(builder.mem, "set_member", "sint", [sv, 0, 0])
+        }
+        let len: Variable | number = typeof(o.len) == "number" ? o.len : limit
+        if (o.limit == "member" && o.len == "limit") {
+            len = builder.assign(builder.tmp(), "member", "sint", [sv, 0])
+        }
+        let chk = builder.assign(builder.tmp(), "ge_u", "i8", [i, len])
+        builder.ifBlock(chk)
+        builder.assign(null, "trap", null, [])
+        builder.end()
+        builder.assign(i, "add", "sint", [i, 1])
+        builder.br(loop)
+        builder.end()
+        builder.end()
+        builder.end()
+        optimizer.removeBoundsChecks(f, [])
+        for(let n = f.next[0]; n && n != f.blockPartner; n = n.next[0]) {
+            if (n.kind == "trap") {
+                return false
+            }
+        }
+        return true
+    }
+
+    it('removes the check of a counter against the loop limit', () => {
+        expect(removesTrap({limit: "param", len: "limit"})).to.equal(true)
+        expect(removesTrap({limit: "param", len: "limit", start: 2})).to.equal(true)
+        expect(removesTrap({limit: "member", len: "limit"})).to.equal(true)
+    })
+
+    it('removes the check of a counter against a constant length', () => {
+        expect(removesTrap({limit: 10, len: 10})).to.equal(true)
+        expect(removesTrap({limit: 10, len: 20})).to.equal(true)
+    })
+
+    it('removes the check in a loop that exits on i == n', () => {
+        expect(removesTrap({exit: "eq", limit: "param", len: "limit"})).to.equal(true)
+    })
+
+    it('keeps the check if the counter is written inside the loop', () => {
+        expect(removesTrap({limit: "param", len: "limit", writeCounter: true})).to.equal(false)
+    })
+
+    it('keeps the check if the limit is modified inside the loop', () => {
+        expect(removesTrap({limit: "param", len: "limit", assignLimit: true})).to.equal(false)
+        expect(removesTrap({limit: "member", len: "limit", setMember: true})).to.equal(false)
+    })
+
+    it('keeps the check if the counter starts negative', () => {
+        expect(removesTrap({limit: "param", len: "limit", start: -1})).to.equal(false)
+    })
+
+    it('keeps the check in a loop that exits on i == n and starts above zero', () => {
+        expect(removesTrap({exit: "eq", limit: "param", len: "limit", start: 1})).to.equal(false)
+    })
+
+    it('keeps the check if the limit is larger than a constant length', () => {
+        expect(removesTrap({limit: 20, len: 10})).to.equal(false)
+    })
+})
+
+describe('Optimizer removeNullChecks()', () => {
+    let optimizer: Optimizer
+
+    before(() => {
+        optimizer = new Optimizer()
+    })
+
+    // Builds a function with the parameters 'p' and 'q' and returns the number of null checks left after optimizing it
+    function checksLeft(build: (b: Builder, p: Variable, q: Variable) => void): number {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType(["addr", "addr"], null))
+        let p = builder.declareParam("addr", "p")
+        let q = builder.declareParam("addr", "q")
+        build(builder, p, q)
+        builder.end()
+        optimizer.removeNullChecks(f, [])
+        let count = 0
+        for(let n = f.next[0]; n && n != f.blockPartner; n = n.next[0]) {
+            if (n.kind == "notnull" || n.kind == "notnull_ref") {
+                count++
+            }
+        }
+        return count
+    }
+
+    it('removes a check after an allocation', () => {
+        expect(checksLeft((b, p) => {
+            b.assign(p, "alloc", "addr", [8])
+            b.assign(null, "notnull_ref", null, [p])
+        })).to.equal(0)
+    })
+
+    it('removes a repeated check', () => {
+        expect(checksLeft((b, p) => {
+            b.assign(null, "notnull", null, [p])
+            b.assign(null, "notnull", null, [p])
+        })).to.equal(1)
+    })
+
+    it('keeps a check after the variable has been assigned again', () => {
+        expect(checksLeft((b, p, q) => {
+            b.assign(p, "alloc", "addr", [8])
+            b.assign(p, "copy", "addr", [q])
+            b.assign(null, "notnull", null, [p])
+        })).to.equal(1)
+    })
+
+    it('keeps notnull_ref after a call or decref in between', () => {
+        let fn = new FunctionType([], null)
+        expect(checksLeft((b, p) => {
+            b.assign(null, "notnull_ref", null, [p])
+            b.call(null, fn, [0])
+            b.assign(null, "notnull_ref", null, [p])
+        })).to.equal(2)
+        expect(checksLeft((b, p, q) => {
+            b.assign(null, "notnull_ref", null, [p])
+            b.assign(null, "decref", "addr", [q, -1])
+            b.assign(null, "notnull_ref", null, [p])
+        })).to.equal(2)
+        // The pointer itself is still not null
+        expect(checksLeft((b, p) => {
+            b.assign(null, "notnull_ref", null, [p])
+            b.call(null, fn, [0])
+            b.assign(null, "notnull", null, [p])
+        })).to.equal(1)
+    })
+
+    it('does not use facts after a loop that assigns the variable', () => {
+        let loop = (assign: boolean) => checksLeft((b, p, q) => {
+            b.assign(null, "notnull", null, [p])
+            let outer = b.block()
+            let l = b.loop()
+            if (assign) {
+                b.assign(p, "copy", "addr", [q])
+            }
+            b.br_if(b.assign(b.tmp(), "eqz", "i8", [q]), outer)
+            b.br(l)
+            b.end()
+            b.end()
+            b.assign(null, "notnull", null, [p])
+        })
+        expect(loop(false)).to.equal(1)
+        expect(loop(true)).to.equal(2)
+    })
+
+    it('forgets everything at a step', () => {
+        expect(checksLeft((b, p) => {
+            b.assign(p, "alloc", "addr", [8])
+            b.assign(null, "step", null, [])
+            b.assign(null, "notnull", null, [p])
+        })).to.equal(1)
+    })
+})
+
+describe('Optimizer inlineCalls()', () => {
+    let optimizer: Optimizer
+    let ft = new FunctionType(["sint", "sint"], "sint")
+
+    before(() => {
+        optimizer = new Optimizer()
+    })
+
+    // Builds `func f(x, y) sint` with the body created by 'build', which returns the result
+    function define(build: (b: Builder, x: Variable, y: Variable) => Variable | number): Node {
+        let builder = new Builder()
+        let f = builder.define("f", ft)
+        let x = builder.declareParam("sint", "x")
+        let y = builder.declareParam("sint", "y")
+        builder.declareResult("sint", "$return")
+        builder.assign(null, "return", "sint", [build(builder, x, y)])
+        builder.end()
+        return f
+    }
+
+    // Builds `func g(a) sint { return f(a, 3) }`, inlines 'f' and returns the nodes of 'g' following its declarations
+    function inline(f: Node): { nodes: Array<Node>, a: Variable, r: Variable } {
+        let builder = new Builder()
+        let g = builder.define("g", new FunctionType(["sint"], "sint"))
+        let a = builder.declareParam("sint", "a")
+        builder.declareResult("sint", "$return")
+        let r = builder.call(builder.tmp(), ft, [1, a, 3])
+        builder.assign(null, "return", "sint", [r])
+        builder.end()
+        optimizer.inlineCalls(g, new Map<number, Node>([[1, f]]))
+        let nodes: Array<Node> = []
+        for(let n = g.next[0]; n && n != g.blockPartner; n = n.next[0]) {
+            if (n.kind != "decl_param" && n.kind != "decl_result") {
+                nodes.push(n)
+            }
+        }
+        return { nodes: nodes, a: a, r: r }
+    }
+
+    let twice = () => define((b, x, y) => {
+        let t = b.assign(b.tmp(), "mul", "sint", [x, 2])
+        return b.assign(b.tmp(), "add", "sint", [t, y])
+    })
+
+    it('accepts small functions with a result', () => {
+        expect(optimizer.isInlinable(twice(), [])).to.equal(true)
+        expect(optimizer.isInlinable(twice(), null)).to.equal(true)
+    })
+
+    it('maps the arguments to the parameters and the result to the assigned variable', () => {
+        let { nodes, a, r } = inline(twice())
+        expect(nodes.map((n) => n.kind)).to.deep.equal(["copy", "copy", "mul", "add", "copy", "return"])
+        let [px, py, mul, add, result] = nodes
+        expect(px.args).to.deep.equal([a])
+        expect(py.args).to.deep.equal([3])
+        expect(mul.args).to.deep.equal([px.assign, 2])
+        expect(add.args).to.deep.equal([mul.assign, py.assign])
+        expect(result.assign).to.equal(r)
+        expect(result.args).to.deep.equal([add.assign])
+    })
+
+    it('counts the reads and writes of the inlined variables', () => {
+        let { nodes, a, r } = inline(twice())
+        for(let n of nodes.slice(0, 4)) {
+            expect(n.assign.writeCount).to.equal(1)
+            expect(n.assign.readCount).to.equal(1)
+        }
+        // The copies read and write the argument and the result instead of the call
+        expect(a.readCount).to.equal(2)
+        expect(r.writeCount).to.equal(1)
+        expect(r.readCount).to.equal(1)
+    })
+
+    it('rejects bodies with calls', () => {
+        expect(optimizer.isInlinable(define((b, x) => b.call(b.tmp(), ft, [2, x, x])), [])).to.equal(false)
+    })
+
+    it('rejects bodies with loops', () => {
+        expect(optimizer.isInlinable(define((b, x) => {
+            let outer = b.block()
+            let l = b.loop()
+            b.br_if(x, outer)
+            b.br(l)
+            b.end()
+            b.end()
+            return x
+        }), [])).to.equal(false)
+    })
+
+    it('rejects bodies which return early', () => {
+        expect(optimizer.isInlinable(define((b, x, y) => {
+            b.ifBlock(x)
+            b.assign(null, "return", "sint", [y])
+            b.end()
+            return x
+        }), [])).to.equal(false)
+    })
+
+    it('rejects bodies which assign the result by name', () => {
+        let builder = new Builder()
+        let f = builder.define("f", ft)
+        let x = builder.declareParam("sint", "x")
+        builder.declareParam("sint", "y")
+        let ret = builder.declareResult("sint", "$return")
+        builder.assign(ret, "copy", "sint", [x])
+        builder.assign(null, "return", "sint", [])
+        builder.end()
+        expect(optimizer.isInlinable(f, [])).to.equal(false)
+    })
+
+    it('rejects bodies using globals or non-numeric constants for other packages', () => {
+        let g = new Variable("g")
+        g.type = "sint"
+        expect(optimizer.isInlinable(define((b, x) => b.assign(b.tmp(), "add", "sint", [x, g])), [g])).to.equal(true)
+        expect(optimizer.isInlinable(define((b, x) => b.assign(b.tmp(), "add", "sint", [x, g])), null)).to.equal(false)
+        let s = new Variable("s")
+        s.type = "addr"
+        s.isConstant = true
+        s.constantValue = "hello"
+        expect(optimizer.isInlinable(define((b, x) => b.assign(b.tmp(), "add", "sint", [x, s])), null)).to.equal(false)
+    })
+
+    // Stores a copy of 'f' as JSON, like the manifest of a package, and restores it
+    let restore = (f: Node) => Optimizer.decodeFunction(JSON.parse(JSON.stringify(Optimizer.encodeFunction(optimizer.copyFunction(f)))))
+    // Both copies have new variables
+    let code = (n: Node) => Node.strainToString("", n).replace(/%[0-9]+/g, "%")
+
+    it('inlines a body restored from the manifest like the original', () => {
+        let f = twice()
+        let restored = restore(f)
+        expect(code(restored)).to.equal(code(optimizer.copyFunction(f)))
+        expect(optimizer.isInlinable(restored, null)).to.equal(true)
+        expect(inline(restored).nodes.map((n) => n.kind)).to.deep.equal(inline(f).nodes.map((n) => n.kind))
+    })
+
+    it('restores constants which JSON cannot represent', () => {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType(["f64"], "f64"))
+        let x = builder.declareParam("f64", "x")
+        let t = builder.assign(builder.tmp(), "copysign", "f64", [x, -0])
+        builder.assign(null, "return", "f64", [builder.assign(builder.tmp(), "min", "f64", [t, Infinity])])
+        builder.end()
+        let body = restore(f).next[0].next[0]
+        expect(Object.is(body.args[1], -0)).to.equal(true)
+        expect(body.next[0].args[1]).to.equal(Infinity)
+    })
+})
+
+describe('Optimizer removeRedundantRefCounting()', () => {
+    let optimizer: Optimizer
+
+    before(() => {
+        optimizer = new Optimizer()
+    })
+
+    // Builds a function with the parameters 'p' and 'q' and returns the kinds of its nodes after optimizing it
+    function kindsLeft(build: (b: Builder, p: Variable, q: Variable) => void): Array<string> {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType(["addr", "addr"], null))
+        let p = builder.declareParam("addr", "p")
+        let q = builder.declareParam("addr", "q")
+        build(builder, p, q)
+        builder.end()
+        optimizer.removeRedundantRefCounting(f)
+        let kinds: Array<string> = []
+        for(let n = f.next[0]; n && n != f.blockPartner; n = n.next[0]) {
+            if (n.kind != "decl_param") {
+                kinds.push(n.kind)
+            }
+        }
+        return kinds
+    }
+
+    it('removes an incref and decref pair', () => {
+        expect(kindsLeft((b, p) => {
+            b.assign(null, "incref", "addr", [p])
+            b.assign(b.tmp(), "load", "sint", [p, 0])
+            b.assign(null, "decref", null, [p, -1])
+        })).to.deep.equal(["load"])
+    })
+
+    it('removes a lock and unlock pair', () => {
+        expect(kindsLeft((b, p) => {
+            b.assign(null, "lock", "addr", [p])
+            b.assign(null, "unlock", null, [p, -1])
+        })).to.deep.equal([])
+    })
+
+    it('turns an incref whose result is used into a copy', () => {
+        expect(kindsLeft((b, p) => {
+            let r = b.assign(b.tmp(), "incref", "addr", [p])
+            b.assign(b.tmp(), "load", "sint", [r, 0])
+            b.assign(null, "decref", null, [r, -1])
+        })).to.deep.equal(["copy", "load"])
+    })
+
+    it('keeps the pair if a node in between might release memory', () => {
+        expect(kindsLeft((b, p) => {
+            b.assign(null, "incref", "addr", [p])
+            b.call(null, new FunctionType([], null), [0])
+            b.assign(null, "decref", null, [p, -1])
+        })).to.deep.equal(["incref", "call", "decref"])
+        expect(kindsLeft((b, p, q) => {
+            b.assign(null, "incref", "addr", [p])
+            b.assign(null, "decref", null, [q, -1])
+            b.assign(null, "decref", null, [p, -1])
+        })).to.deep.equal(["incref", "decref", "decref"])
+    })
+
+    it('keeps the pair if the decref is outside of the block', () => {
+        expect(kindsLeft((b, p, q) => {
+            b.ifBlock(q)
+            b.assign(null, "incref", "addr", [p])
+            b.end()
+            b.assign(null, "decref", null, [p, -1])
+        })).to.deep.equal(["if", "incref", "end", "decref"])
+    })
+})
+
+describe('Optimizer allocateOnStack()', () => {
+    let optimizer: Optimizer
+
+    before(() => {
+        optimizer = new Optimizer()
+    })
+
+    // Builds a function which allocates 'size' bytes, passes the pointer to 'use' and frees it.
+    // Returns the kinds of the nodes after optimizing the function.
+    function kindsLeft(size: number, use: (b: Builder, p: Variable) => void, dtor: number = -1): Array<string> {
+        let builder = new Builder()
+        let f = builder.define("f", new FunctionType([], null))
+        let p = builder.assign(builder.tmp(), "alloc", "addr", [size])
+        builder.assign(null, "notnull", null, [p])
+        use(builder, p)
+        builder.assign(null, "free", null, [p, dtor])
+        builder.end()
+        optimizer.allocateOnStack(f)
+        let kinds: Array<string> = []
+        for(let n = f.next[0]; n && n != f.blockPartner; n = n.next[0]) {
+            kinds.push(n.kind)
+        }
+        return kinds
+    }
+
+    let loadAndStore = (b: Builder, p: Variable) => {
+        b.assign(b.mem, "store", "sint", [p, 0, 1])
+        b.assign(b.tmp(), "load", "sint", [p, 0])
+    }
+
+    it('allocates an object on the stack if it is only loaded from and stored to', () => {
+        expect(kindsLeft(16, loadAndStore)).to.deep.equal(["struct", "addr_of", "store", "load"])
+    })
+
+    it('keeps heap allocations of objects that escape', () => {
+        expect(kindsLeft(16, (b, p) => b.call(null, new FunctionType(["addr"], null), [0, p]))).to.contain("alloc")
+        expect(kindsLeft(16, (b, p) => b.assign(b.mem, "store", "addr", [p, 0, p]))).to.contain("alloc")
+    })
+
+    it('keeps heap allocations of objects with a destructor', () => {
+        expect(kindsLeft(16, loadAndStore, 3)).to.contain("alloc")
+    })
+
+    it('keeps heap allocations of large objects', () => {
+        expect(kindsLeft(1024, loadAndStore)).to.contain("alloc")
+    })
+})
@@ -1056,6 +1056,7 @@ export class TypeChecker {
         } else {
             let importPath: string = inode.rhs.value;
             let p = Package.resolve(importPath, inode.rhs.loc);
+            this.pkg.addImport(p);
             let ip: ImportedPackage;
             if (!inode.lhs) {
                 // Syntax of the kind: import "path/to/module"
@@ -1204,6 +1205,7 @@ export class TypeChecker {
         } else {
             let importPath: string = inode.rhs.value;
             let p = Package.resolve(importPath, inode.rhs.loc);
+            this.pkg.addImport(p);
             let ip: ImportedPackage;
             if (!inode.lhs) {
                 // Syntax of the kind: import "path/to/module"
@@ -1270,6 +1272,7 @@ export class TypeChecker {
         } else {
             let importPath: string = inode.rhs.value;
             let p = Package.resolve(importPath, inode.rhs.loc);
+            this.pkg.addImport(p);
             let ip: ImportedPackage;
             if (!inode.lhs) {
                 // Syntax of the kind: import "path/to/module"
@@ -1327,6 +1330,25 @@ export class TypeChecker {
         }
     }
 
+    private processConfig(snode: Node, pkg: Package) {
+        if (snode.parameters) {
+            for(let p of snode.parameters) {
+                if (p.op != "config_property") {
+                    throw new ImplementationError(snode.op)
+                }
+                if (p.name.value == "stacksize") {
+                    if (p.rhs.op != "int" || parseInt(p.rhs.value) <= 0) {
+                        throw new TypeError("The stack size must be a positive integer", p.rhs.loc);
+                    }
+                    pkg.stackSize = parseInt(p.rhs.value);
+                } else if (p.name.value == "biasedrc") {
+                    pkg.biasedRC = (p.rhs.value == "true");
+                }
+                // "singleton" and "irc" have no effect yet
+            }
+        }
+    }
+
     /**
      * The main function of the Typechecker that checks the types of an entire module.
      * However, this function just handles all imports and declares typedefs (but does not yet define them).
@@ -1372,6 +1394,8 @@ export class TypeChecker {
                     this.createImport(snode, fnode.scope);
                 } else if (snode.op == "build") {
                     this.processBuildInstructions(snode, pkg);
+                } else if (snode.op == "config") {
+                    this.processConfig(snode, pkg);
                 }
             }
         }
@@ -1444,6 +1468,8 @@ export class TypeChecker {
                     // Do nothing by intention
                 } else if (snode.op == "build") {
                     // Do nothing by intention
+                } else if (snode.op == "config") {
+                    // Do nothing by intention
                 } else if (snode.op == "export_as") {
                     // Do nothing by intention
                 } else {
@@ -1531,6 +1557,10 @@ export class TypeChecker {
      * Checks all function bodies
      */
     public checkModulePassFour() {
+        // The interface of a package contains no function bodies, except for templates
+        if (this.pkg.fromInterface) {
+            return;
+        }
         // Check function bodies
         for(let e of this.functions) {
             this.checkFunctionBody(e);
@@ -5505,6 +5535,14 @@ export class TypeChecker {
         return new Group(kind, "return");
     }
 
+    /**
+     * Returns the AST nodes of all functions which are not templates.
+     * Importers of the package do not need their bodies, see Package.writeInterface.
+     */
+    public functionNodes(): Array<Node> {
+        return this.functions.filter((f) => !f.isTemplateInstance).map((f) => f.node);
+    }
+
     public hasTemplateInstantiations(): boolean {
         return (this.templateFunctionInstantiations.size != 0 || this.templateTypeInstantiations.size != 0);
     }
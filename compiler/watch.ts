@@ -0,0 +1,155 @@
+import fs = require("fs");
+import path = require("path");
+import {Package} from "./pkg";
+
+/**
+ * Keeps the compiler running and rebuilds whenever a file of a package in the build changes.
+ * Packages, their scopes and their typechecker state stay in memory between builds.
+ * Hence, only the changed packages and the packages importing them are parsed and typechecked again.
+ * Code generation and gcc are skipped for all packages whose inputs did not change, see Package.inputHash.
+ */
+export class Watcher {
+    /**
+     * @param build compiles all packages of the build. `changed` is null for the first build.
+     * The promise is resolved to false if the build failed.
+     */
+    constructor(build: (changed: Array<Package> | null) => Promise<boolean>) {
+        this.build = build;
+    }
+
+    public start() {
+        this.run(null);
+    }
+
+    private run(changed: Array<Package> | null) {
+        this.building = true;
+        this.build(changed).then((ok) => {
+            if (ok) {
+                this.failed = [];
+            } else {
+                // Load these packages again on the next change, since their state might be incomplete
+                this.failed = changed ? changed : Package.getPackages().slice();
+            }
+            this.building = false;
+            this.watchPackages();
+            if (this.changed.length != 0) {
+                this.schedule();
+            } else {
+                console.log("Watching for changes ...");
+            }
+        });
+    }
+
+    /**
+     * Watches the source directories of all packages currently in the build.
+     */
+    private watchPackages() {
+        let dirs = new Map<string, Array<Package>>();
+        for(let p of Package.getPackages()) {
+            if (p.isInternal) {
+                continue;
+            }
+            let pdirs: Array<string> = [];
+            if (p.fyrPath && p.pkgPath) {
+                pdirs.push(p.sourcePath());
+            } else {
+                for(let f of p.files.concat(p.nativeFiles)) {
+                    pdirs.push(path.dirname(path.resolve(f)));
+                }
+            }
+            for(let dir of pdirs) {
+                let arr = dirs.get(dir);
+                if (!arr) {
+                    dirs.set(dir, [p]);
+                } else if (arr.indexOf(p) == -1) {
+                    arr.push(p);
+                }
+            }
+        }
+        for(let [dir, w] of this.watchers) {
+            if (!dirs.has(dir)) {
+                w.close();
+                this.watchers.delete(dir);
+            }
+        }
+        this.packagesByDir = dirs;
+        for(let dir of dirs.keys()) {
+            if (this.watchers.has(dir)) {
+                continue;
+            }
+            try {
+                this.watchers.set(dir, fs.watch(dir, (event: string, filename: string) => this.onChange(dir, filename)));
+            } catch(e) {
+                console.log("Cannot watch " + dir);
+            }
+        }
+    }
+
+    private onChange(dir: string, filename: string) {
+        if (!filename || !/\.(fyr|c|h)$/.test(filename) || this.isBuildOutput(dir, filename)) {
+            return;
+        }
+        let pkgs = this.packagesByDir.get(dir);
+        if (!pkgs) {
+            return;
+        }
+        for(let p of pkgs) {
+            if (this.changed.indexOf(p) == -1) {
+                this.changed.push(p);
+            }
+        }
+        if (!this.building) {
+            this.schedule();
+        }
+    }
+
+    /**
+     * Returns true for the C files which the build itself writes.
+     * The generated files of a main package outside of the Fyr paths are placed next to its sources.
+     * Reacting to them would start the next build as soon as a build has finished.
+     */
+    private isBuildOutput(dir: string, filename: string): boolean {
+        for(let p of Package.getPackages()) {
+            if (p.isInternal || !p.objFilePath || path.resolve(p.objFilePath) != dir) {
+                continue;
+            }
+            if (filename == p.objFileName + ".c" || filename == p.objFileName + ".h" || filename == p.objFileName + ".unity.c") {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Editors often write a file in several steps. Therefore, wait a little before rebuilding.
+     */
+    private schedule() {
+        if (this.timer) {
+            clearTimeout(this.timer);
+        }
+        this.timer = setTimeout(() => {
+            this.timer = null;
+            if (this.building) {
+                return;
+            }
+            let changed = this.changed;
+            for(let p of this.failed) {
+                if (changed.indexOf(p) == -1) {
+                    changed.push(p);
+                }
+            }
+            this.changed = [];
+            this.run(changed);
+        }, 50);
+    }
+
+    private build: (changed: Array<Package> | null) => Promise<boolean>;
+    private building: boolean = false;
+    // Packages whose files changed since the last build started
+    private changed: Array<Package> = [];
+    // Packages which have been loaded during a failed build
+    private failed: Array<Package> = [];
+    private timer: any = null;
+    private watchers: Map<string, fs.FSWatcher> = new Map<string, fs.FSWatcher>();
+    private packagesByDir: Map<string, Array<Package>> = new Map<string, Array<Package>>();
+}
@@ -0,0 +1,351 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "fyr.h"
+#include "fyr_spawn.h"
+#include "fyr_poll.h"
+
+// Number of slots of the timer wheel. Each slot covers one millisecond.
+// Timers further in the future stay in their slot for more than one revolution.
+#define FYR_WHEEL_SLOTS 512
+// Maximum number of events handled per call to epoll_wait
+#define FYR_POLL_EVENTS 64
+
+// A coroutine waiting for an event. It lives on the stack of the waiting coroutine.
+struct fyr_poll_waiter {
+    struct fyr_coro_t *coro;
+    // -1 if the coroutine is only waiting for its deadline
+    int fd;
+    int events;
+    // The events that occurred or 0 on timeout
+    int result;
+    // Set when the waiter has been removed from the event loop
+    bool done;
+    // Absolute time in milliseconds or 0 for no deadline
+    uint64_t deadline;
+    // Links in the slot of the timer wheel
+    struct fyr_poll_waiter *prev;
+    struct fyr_poll_waiter *next;
+};
+
+// Coroutines waiting on a file descriptor
+struct fyr_poll_fdstate {
+    struct fyr_poll_waiter *in;
+    struct fyr_poll_waiter *out;
+    // The file descriptor has been added to the epoll instance.
+    // It is registered with EPOLLONESHOT and must be re-armed with EPOLL_CTL_MOD after each event.
+    bool registered;
+};
+
+// Protects all of the following, because native code on other threads might add waiters.
+static pthread_mutex_t fyr_poll_lock = PTHREAD_MUTEX_INITIALIZER;
+static int fyr_poll_epoll = -1;
+// Wakes up a poller blocked in epoll_wait when a waiter with an earlier deadline is added
+static int fyr_poll_wakeup = -1;
+static bool fyr_poll_blocked;
+static struct fyr_poll_fdstate *fyr_poll_fds;
+static int fyr_poll_fdcount;
+// Number of waiters which have not been resumed yet
+static int fyr_poll_waiters;
+static struct fyr_poll_waiter *fyr_wheel[FYR_WHEEL_SLOTS];
+// The time up to which the wheel has been processed
+static uint64_t fyr_wheel_now;
+static int fyr_wheel_count;
+
+static uint64_t fyr_poll_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void fyr_wheel_add(struct fyr_poll_waiter *w) {
+    if (w->deadline <= fyr_wheel_now) {
+        // The slot of fyr_wheel_now has already been processed
+        w->deadline = fyr_wheel_now + 1;
+    }
+    struct fyr_poll_waiter **slot = &fyr_wheel[w->deadline % FYR_WHEEL_SLOTS];
+    w->prev = NULL;
+    w->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = w;
+    }
+    *slot = w;
+    fyr_wheel_count++;
+}
+
+static void fyr_wheel_remove(struct fyr_poll_waiter *w) {
+    if (w->prev != NULL) {
+        w->prev->next = w->next;
+    } else {
+        fyr_wheel[w->deadline % FYR_WHEEL_SLOTS] = w->next;
+    }
+    if (w->next != NULL) {
+        w->next->prev = w->prev;
+    }
+    w->prev = NULL;
+    w->next = NULL;
+    fyr_wheel_count--;
+}
+
+// Returns the number of milliseconds until the next deadline or -1 if there is none.
+static int fyr_wheel_timeout(void) {
+    if (fyr_wheel_count == 0) {
+        return -1;
+    }
+    for(int i = 1; i < FYR_WHEEL_SLOTS; i++) {
+        uint64_t t = fyr_wheel_now + i;
+        for(struct fyr_poll_waiter *w = fyr_wheel[t % FYR_WHEEL_SLOTS]; w != NULL; w = w->next) {
+            if (w->deadline == t) {
+                return i;
+            }
+        }
+    }
+    // All deadlines are more than one revolution ahead
+    return FYR_WHEEL_SLOTS;
+}
+
+// Removes the waiter from the event loop and resumes its coroutine
+static void fyr_poll_finish(struct fyr_poll_waiter *w, int result) {
+    if (w->deadline != 0) {
+        fyr_wheel_remove(w);
+    }
+    if (w->fd >= 0) {
+        struct fyr_poll_fdstate *s = &fyr_poll_fds[w->fd];
+        if (s->in == w) {
+            s->in = NULL;
+        }
+        if (s->out == w) {
+            s->out = NULL;
+        }
+    }
+    fyr_poll_waiters--;
+    struct fyr_coro_t *c = w->coro;
+    w->result = result;
+    // From now on, the waiting coroutine may return and release the waiter
+    __atomic_store_n(&w->done, true, __ATOMIC_RELEASE);
+    fyr_scheduler.resume(c);
+}
+
+// Processes all slots of the timer wheel up to `now`
+static void fyr_wheel_advance(uint64_t now) {
+    if (now <= fyr_wheel_now) {
+        return;
+    }
+    uint64_t ticks = now - fyr_wheel_now;
+    if (ticks > FYR_WHEEL_SLOTS) {
+        ticks = FYR_WHEEL_SLOTS;
+    }
+    for(uint64_t i = 1; i <= ticks && fyr_wheel_count != 0; i++) {
+        struct fyr_poll_waiter *w = fyr_wheel[(fyr_wheel_now + i) % FYR_WHEEL_SLOTS];
+        while (w != NULL) {
+            struct fyr_poll_waiter *next = w->next;
+            if (w->deadline <= now) {
+                fyr_poll_finish(w, 0);
+            }
+            w = next;
+        }
+    }
+    fyr_wheel_now = now;
+}
+
+// Tells epoll which events the waiters of `fd` are interested in. Returns false on error.
+static bool fyr_poll_arm(int fd) {
+    struct fyr_poll_fdstate *s = &fyr_poll_fds[fd];
+    struct epoll_event ev;
+    ev.events = EPOLLONESHOT;
+    if (s->in != NULL) {
+        ev.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (s->out != NULL) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = fd;
+    if (s->registered) {
+        if (epoll_ctl(fyr_poll_epoll, EPOLL_CTL_MOD, fd, &ev) == 0) {
+            return true;
+        }
+        // The file descriptor has been closed in the meantime, which removed it from epoll.
+        // Its number has been reused.
+        if (errno != ENOENT) {
+            return false;
+        }
+        s->registered = false;
+    }
+    if (epoll_ctl(fyr_poll_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        return false;
+    }
+    s->registered = true;
+    return true;
+}
+
+static void fyr_poll_dispatch(struct epoll_event *ev) {
+    int fd = ev->data.fd;
+    if (fd == fyr_poll_wakeup) {
+        uint64_t value;
+        if (read(fyr_poll_wakeup, &value, sizeof(value)) < 0) {
+            // Nothing to do. The counter has been reset by an earlier read.
+        }
+        return;
+    }
+    if (fd >= fyr_poll_fdcount) {
+        return;
+    }
+    struct fyr_poll_fdstate *s = &fyr_poll_fds[fd];
+    int occurred = 0;
+    if (ev->events & (EPOLLERR | EPOLLHUP)) {
+        occurred = FYR_POLL_IN | FYR_POLL_OUT;
+    }
+    if (ev->events & (EPOLLIN | EPOLLRDHUP)) {
+        occurred |= FYR_POLL_IN;
+    }
+    if (ev->events & EPOLLOUT) {
+        occurred |= FYR_POLL_OUT;
+    }
+    if (s->in != NULL && (occurred & FYR_POLL_IN)) {
+        fyr_poll_finish(s->in, occurred & s->in->events);
+    }
+    if (s->out != NULL && (occurred & FYR_POLL_OUT)) {
+        fyr_poll_finish(s->out, occurred & s->out->events);
+    }
+    // EPOLLONESHOT has disabled the file descriptor. Re-arm it for the remaining waiter.
+    if (s->in != NULL || s->out != NULL) {
+        fyr_poll_arm(fd);
+    }
+}
+
+// Installed as fyr_poller. Called by the scheduler when no coroutine is ready.
+static bool fyr_poll(bool block) {
+    struct epoll_event events[FYR_POLL_EVENTS];
+    pthread_mutex_lock(&fyr_poll_lock);
+    if (fyr_poll_waiters == 0) {
+        pthread_mutex_unlock(&fyr_poll_lock);
+        return false;
+    }
+    int waiters = fyr_poll_waiters;
+    fyr_wheel_advance(fyr_poll_now());
+    int timeout = 0;
+    // Do not block if some deadline has passed, because its coroutine is ready now
+    if (block && fyr_poll_waiters == waiters) {
+        timeout = fyr_wheel_timeout();
+    }
+    fyr_poll_blocked = timeout != 0;
+    pthread_mutex_unlock(&fyr_poll_lock);
+    int n = epoll_wait(fyr_poll_epoll, events, FYR_POLL_EVENTS, timeout);
+    pthread_mutex_lock(&fyr_poll_lock);
+    fyr_poll_blocked = false;
+    for(int i = 0; i < n; i++) {
+        fyr_poll_dispatch(&events[i]);
+    }
+    fyr_wheel_advance(fyr_poll_now());
+    pthread_mutex_unlock(&fyr_poll_lock);
+    return true;
+}
+
+// Must be called with fyr_poll_lock held
+static void fyr_poll_init(void) {
+    if (fyr_poll_epoll >= 0) {
+        return;
+    }
+    fyr_poll_epoll = epoll_create1(EPOLL_CLOEXEC);
+    fyr_poll_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fyr_poll_epoll < 0 || fyr_poll_wakeup < 0) {
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fyr_poll_wakeup;
+    if (epoll_ctl(fyr_poll_epoll, EPOLL_CTL_ADD, fyr_poll_wakeup, &ev) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    fyr_wheel_now = fyr_poll_now();
+    fyr_poller = fyr_poll;
+}
+
+// Must be called with fyr_poll_lock held
+static void fyr_poll_reserve(int fd) {
+    if (fd < fyr_poll_fdcount) {
+        return;
+    }
+    int count = fyr_poll_fdcount == 0 ? 64 : fyr_poll_fdcount;
+    while (count <= fd) {
+        count *= 2;
+    }
+    struct fyr_poll_fdstate *fds = realloc(fyr_poll_fds, count * sizeof(struct fyr_poll_fdstate));
+    if (fds == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(fds + fyr_poll_fdcount, 0, (count - fyr_poll_fdcount) * sizeof(struct fyr_poll_fdstate));
+    fyr_poll_fds = fds;
+    fyr_poll_fdcount = count;
+}
+
+int fyr_poll_fd(int fd, int events, int timeout) {
+    struct fyr_poll_waiter w;
+    w.coro = fyr_scheduler.running();
+    w.fd = fd;
+    w.events = events & (FYR_POLL_IN | FYR_POLL_OUT);
+    w.result = 0;
+    w.done = false;
+    w.deadline = 0;
+    w.prev = NULL;
+    w.next = NULL;
+    if (fd >= 0 && w.events == 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&fyr_poll_lock);
+    fyr_poll_init();
+    if (fd >= 0) {
+        fyr_poll_reserve(fd);
+        struct fyr_poll_fdstate *s = &fyr_poll_fds[fd];
+        if ((w.events & FYR_POLL_IN && s->in != NULL) || (w.events & FYR_POLL_OUT && s->out != NULL)) {
+            pthread_mutex_unlock(&fyr_poll_lock);
+            return -1;
+        }
+        if (w.events & FYR_POLL_IN) {
+            s->in = &w;
+        }
+        if (w.events & FYR_POLL_OUT) {
+            s->out = &w;
+        }
+        if (!fyr_poll_arm(fd)) {
+            // E.g. regular files do not support epoll
+            if (s->in == &w) {
+                s->in = NULL;
+            }
+            if (s->out == &w) {
+                s->out = NULL;
+            }
+            pthread_mutex_unlock(&fyr_poll_lock);
+            return -1;
+        }
+    }
+    if (timeout >= 0) {
+        w.deadline = fyr_poll_now() + (uint64_t)timeout;
+        fyr_wheel_add(&w);
+        if (fyr_poll_blocked) {
+            // The poller might sleep past the new deadline
+            uint64_t one = 1;
+            if (write(fyr_poll_wakeup, &one, sizeof(one)) < 0) {
+                // The counter is saturated, i.e. the poller wakes up anyway
+            }
+        }
+    }
+    fyr_poll_waiters++;
+    pthread_mutex_unlock(&fyr_poll_lock);
+    // Other coroutines might resume this one as well. Wait until the event loop has released the waiter.
+    while (!__atomic_load_n(&w.done, __ATOMIC_ACQUIRE)) {
+        fyr_scheduler.yield(true);
+    }
+    return w.result;
+}
+
+void fyr_poll_sleep(int ms) {
+    fyr_poll_fd(-1, 0, ms < 0 ? 0 : ms);
+}
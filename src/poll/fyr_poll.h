@@ -0,0 +1,21 @@
+#ifndef FYR_POLL
+#define FYR_POLL
+
+// Event loop for coroutines based on epoll and a timer wheel.
+// Waiting coroutines are suspended and resumed by the scheduler once their event has occurred.
+// The scheduler polls for events whenever no coroutine is ready to run.
+
+// Events of fyr_poll_fd
+#define FYR_POLL_IN 1
+#define FYR_POLL_OUT 2
+
+// Suspends the running coroutine until one of the `events` occurs on the non-blocking file descriptor `fd`
+// or until `timeout` milliseconds have passed. A negative timeout waits forever.
+// Returns the events that occurred, 0 on timeout and -1 if `fd` cannot be polled or another coroutine
+// is already waiting for the same event on `fd`.
+// Hang-ups and errors are reported as the requested events, such that the following read or write reports them.
+int fyr_poll_fd(int fd, int events, int timeout);
+// Suspends the running coroutine for `ms` milliseconds.
+void fyr_poll_sleep(int ms);
+
+#endif
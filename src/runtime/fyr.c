@@ -4,13 +4,492 @@
 #include <assert.h>
 #include <string.h>
 
+#ifndef FYR_MEM_LIBC
+#include <sys/mman.h>
+#endif
+
 // #include <stdio.h>
-#define VALGRIND 1
 
-addr_t fyr_alloc(int_t size) {
-    // TODO: If int_t is larger than size_t, the size could be shortened.
-    int_t* ptr = calloc(1, (size_t)size + 2 * sizeof(int_t));
-    // printf("calloc %lx\n", (long)ptr);
+#ifdef FYR_MEM_LIBC
+
+// Compiling with -DFYR_MEM_LIBC routes all allocations to calloc/free.
+// This is required for checking memory leaks with valgrind.
+#define fyr_mem_alloc(size) calloc(1, size)
+#define fyr_mem_alloc_raw(size) malloc(size)
+#define fyr_mem_free(ptr) free(ptr)
+// realloc may move the block while shrinking. Hence, the memory is not released before the block is freed.
+#define fyr_mem_shrink(ptr, size)
+
+#else
+
+/**
+ * The runtime uses its own size-class allocator.
+ *
+ * Memory is obtained from the OS in batches of chunks via mmap.
+ * All chunks are aligned to FYR_MEM_CHUNK_SIZE, such that the chunk of a block
+ * can be found by masking the address of the block.
+ * Small blocks are carved from a chunk with a bump pointer.
+ * Each chunk remembers the size class of every block that starts in it
+ * (one byte per granule), hence freeing a block does not require to know its size.
+ * Freed blocks are put on a thread-local free list of their size class.
+ * Blocks larger than FYR_MEM_MAX_SMALL are mapped individually.
+ */
+#define FYR_MEM_GRANULE 16
+#define FYR_MEM_CHUNK_SIZE (64 * 1024)
+#define FYR_MEM_GRANULES (FYR_MEM_CHUNK_SIZE / FYR_MEM_GRANULE)
+// Number of chunks that are mapped at once
+#define FYR_MEM_BATCH 16
+#define FYR_MEM_CLASSES 32
+#define FYR_MEM_MAX_SMALL 8192
+
+#define FYR_MEM_KIND_SMALL 1
+#define FYR_MEM_KIND_LARGE 2
+
+struct fyr_mem_chunk {
+    uint32_t kind;
+    // The number of mapped bytes. Only used for large blocks.
+    size_t size;
+};
+
+struct fyr_mem_small_chunk {
+    struct fyr_mem_chunk head;
+    // The size class of the block starting at the respective granule.
+    uint8_t classes[FYR_MEM_GRANULES];
+};
+
+#define FYR_MEM_ROUND(size, align) (((size) + (align) - 1) & ~((size_t)(align) - 1))
+#define FYR_MEM_SMALL_HEADER FYR_MEM_ROUND(sizeof(struct fyr_mem_small_chunk), FYR_MEM_GRANULE)
+#define FYR_MEM_LARGE_HEADER FYR_MEM_ROUND(sizeof(struct fyr_mem_chunk), FYR_MEM_GRANULE)
+
+// 8 classes in steps of 16 bytes up to 128, then 4 classes per power of two.
+static const uint16_t fyr_mem_class_size[FYR_MEM_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096, 5120, 6144, 7168, 8192
+};
+
+struct fyr_mem_heap {
+    // Free lists of all size classes. A free block stores the pointer to the next free block.
+    void* free[FYR_MEM_CLASSES];
+    // Unused memory in the chunk that is currently carved up.
+    uint8_t* bump;
+    uint8_t* bump_end;
+    // Chunks of the last batch that have not yet been used.
+    uint8_t* spare;
+    uint8_t* spare_end;
+};
+
+static __thread struct fyr_mem_heap fyr_heap;
+
+static inline int fyr_mem_class(size_t size) {
+    if (size <= 128) {
+        return size == 0 ? 0 : (int)((size - 1) / 16);
+    }
+    int shift = 63 - __builtin_clzll((unsigned long long)(size - 1));
+    size_t step = (size_t)1 << (shift - 2);
+    return 8 + (shift - 7) * 4 + (int)((size - 1 - ((size_t)1 << shift)) / step);
+}
+
+static inline struct fyr_mem_chunk* fyr_mem_chunk_of(void* ptr) {
+    return (struct fyr_mem_chunk*)((uintptr_t)ptr & ~(uintptr_t)(FYR_MEM_CHUNK_SIZE - 1));
+}
+
+/**
+ * Maps 'size' bytes of zeroed memory aligned to FYR_MEM_CHUNK_SIZE.
+ */
+static uint8_t* fyr_mem_map(size_t size) {
+    // Map more than required, such that the start can be aligned.
+    size_t len = size + FYR_MEM_CHUNK_SIZE;
+    uint8_t* p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        exit(EXIT_FAILURE);
+    }
+    uint8_t* aligned = (uint8_t*)FYR_MEM_ROUND((uintptr_t)p, FYR_MEM_CHUNK_SIZE);
+    if (aligned != p) {
+        munmap(p, aligned - p);
+    }
+    if (p + len != aligned + size) {
+        munmap(aligned + size, p + len - (aligned + size));
+    }
+    return aligned;
+}
+
+static inline void fyr_mem_push(uint8_t* block, int cls) {
+    struct fyr_mem_small_chunk* chunk = (struct fyr_mem_small_chunk*)fyr_mem_chunk_of(block);
+    chunk->classes[(block - (uint8_t*)chunk) / FYR_MEM_GRANULE] = cls;
+    *(void**)block = fyr_heap.free[cls];
+    fyr_heap.free[cls] = block;
+}
+
+/**
+ * Puts the memory range on the free lists by splitting it into blocks of the largest fitting size classes.
+ * The range must be located inside a small chunk and its size must be a multiple of FYR_MEM_GRANULE.
+ */
+static void fyr_mem_release_range(uint8_t* ptr, size_t size) {
+    int cls = FYR_MEM_CLASSES - 1;
+    while (size != 0) {
+        while (fyr_mem_class_size[cls] > size) {
+            cls--;
+        }
+        fyr_mem_push(ptr, cls);
+        ptr += fyr_mem_class_size[cls];
+        size -= fyr_mem_class_size[cls];
+    }
+}
+
+static void* fyr_mem_carve(int cls) {
+    size_t size = fyr_mem_class_size[cls];
+    if ((size_t)(fyr_heap.bump_end - fyr_heap.bump) < size) {
+        // Do not waste the rest of the current chunk
+        if (fyr_heap.bump != NULL) {
+            fyr_mem_release_range(fyr_heap.bump, fyr_heap.bump_end - fyr_heap.bump);
+        }
+        if (fyr_heap.spare == fyr_heap.spare_end) {
+            fyr_heap.spare = fyr_mem_map(FYR_MEM_BATCH * FYR_MEM_CHUNK_SIZE);
+            fyr_heap.spare_end = fyr_heap.spare + FYR_MEM_BATCH * FYR_MEM_CHUNK_SIZE;
+        }
+        struct fyr_mem_small_chunk* chunk = (struct fyr_mem_small_chunk*)fyr_heap.spare;
+        fyr_heap.spare += FYR_MEM_CHUNK_SIZE;
+        chunk->head.kind = FYR_MEM_KIND_SMALL;
+        fyr_heap.bump = (uint8_t*)chunk + FYR_MEM_SMALL_HEADER;
+        fyr_heap.bump_end = (uint8_t*)chunk + FYR_MEM_CHUNK_SIZE;
+    }
+    uint8_t* block = fyr_heap.bump;
+    fyr_heap.bump += size;
+    struct fyr_mem_small_chunk* chunk = (struct fyr_mem_small_chunk*)fyr_mem_chunk_of(block);
+    chunk->classes[(block - (uint8_t*)chunk) / FYR_MEM_GRANULE] = cls;
+    // Memory that has never been used is zero, because it comes straight from mmap.
+    return block;
+}
+
+/**
+ * Allocates 'size' bytes aligned to FYR_MEM_GRANULE. The memory is not necessarily zeroed.
+ * For a constant 'size', the compiler computes the size class at compile time.
+ */
+static inline void* fyr_mem_alloc_raw(size_t size) {
+    if (size > FYR_MEM_MAX_SMALL) {
+        size_t len = FYR_MEM_ROUND(FYR_MEM_LARGE_HEADER + size, FYR_MEM_CHUNK_SIZE);
+        struct fyr_mem_chunk* chunk = (struct fyr_mem_chunk*)fyr_mem_map(len);
+        chunk->kind = FYR_MEM_KIND_LARGE;
+        chunk->size = len;
+        return (uint8_t*)chunk + FYR_MEM_LARGE_HEADER;
+    }
+    int cls = fyr_mem_class(size);
+    void* block = fyr_heap.free[cls];
+    if (block == NULL) {
+        return fyr_mem_carve(cls);
+    }
+    fyr_heap.free[cls] = *(void**)block;
+    return block;
+}
+
+/**
+ * Allocates 'size' bytes of zeroed memory aligned to FYR_MEM_GRANULE.
+ */
+static void* fyr_mem_alloc(size_t size) {
+    if (size > FYR_MEM_MAX_SMALL) {
+        return fyr_mem_alloc_raw(size);
+    }
+    int cls = fyr_mem_class(size);
+    void* block = fyr_heap.free[cls];
+    if (block == NULL) {
+        return fyr_mem_carve(cls);
+    }
+    fyr_heap.free[cls] = *(void**)block;
+    memset(block, 0, size);
+    return block;
+}
+
+static void fyr_mem_free(void* ptr) {
+    struct fyr_mem_chunk* chunk = fyr_mem_chunk_of(ptr);
+    if (chunk->kind == FYR_MEM_KIND_LARGE) {
+        munmap(chunk, chunk->size);
+        return;
+    }
+    struct fyr_mem_small_chunk* small = (struct fyr_mem_small_chunk*)chunk;
+    int cls = small->classes[((uint8_t*)ptr - (uint8_t*)chunk) / FYR_MEM_GRANULE];
+    *(void**)ptr = fyr_heap.free[cls];
+    fyr_heap.free[cls] = ptr;
+}
+
+/**
+ * Releases everything but the first 'size' bytes of a block.
+ * In contrast to realloc, the block is guaranteed not to move.
+ * The remaining block can be freed with fyr_mem_free as usual.
+ */
+static void fyr_mem_shrink(void* ptr, size_t size) {
+    struct fyr_mem_chunk* chunk = fyr_mem_chunk_of(ptr);
+    if (chunk->kind == FYR_MEM_KIND_LARGE) {
+        // Unmap all chunk-sized pieces following the one that contains the block header.
+        size_t len = FYR_MEM_ROUND((uint8_t*)ptr - (uint8_t*)chunk + size, FYR_MEM_CHUNK_SIZE);
+        if (len < chunk->size) {
+            munmap((uint8_t*)chunk + len, chunk->size - len);
+            chunk->size = len;
+        }
+        return;
+    }
+    // Turn the block into a block of a smaller size class and put the tail on the free lists.
+    struct fyr_mem_small_chunk* small = (struct fyr_mem_small_chunk*)chunk;
+    uint8_t* cls = &small->classes[((uint8_t*)ptr - (uint8_t*)chunk) / FYR_MEM_GRANULE];
+    int keep = fyr_mem_class(size);
+    if (keep < *cls) {
+        size_t tail = fyr_mem_class_size[*cls] - fyr_mem_class_size[keep];
+        *cls = keep;
+        fyr_mem_release_range((uint8_t*)ptr + fyr_mem_class_size[keep], tail);
+    }
+}
+
+#endif
+
+#ifdef FYR_BIASED_RC
+
+#include <pthread.h>
+#include <stdio.h>
+
+/**
+ * Biased reference counting.
+ *
+ * Every object is biased towards the thread that allocated it, its owner.
+ * The owner increments and decrements the reference count in the object header without atomic operations.
+ * All other threads count their references in a separate shared counter using atomic operations.
+ *
+ * The header of an object is [owner][shared][locks][references], the header of an array
+ * is [count][owner][shared][locks][references]. The shared counter is (count << 2) | flags.
+ * The count may become negative when another thread releases a reference that has been counted by the owner.
+ *
+ * Once the owner has released all its references (see fyr_brc_release), it merges the counters
+ * by setting FYR_BRC_MERGED. From then on, the thread that decrements the shared counter to zero frees the object.
+ * If the shared count becomes negative before, the object is queued for its owner (FYR_BRC_QUEUED).
+ * The owner adds the shared count to its own counter in fyr_brc_drain.
+ *
+ * Locks are not biased. The owning pointer must be released and locks must be taken on the owner thread,
+ * unless the owner does not access the object any more.
+ *
+ * The id of a thread that exits is assigned to the next new thread. That thread becomes the owner
+ * of all objects the exited thread still owns and drains its queue.
+ */
+#define FYR_BRC_MERGED 1
+#define FYR_BRC_QUEUED 2
+#define FYR_BRC_ONE 4
+#define FYR_BRC_MAX_THREADS 4096
+
+struct fyr_brc {
+    // Zero if the owner has released all its references
+    uint32_t owner;
+    int32_t shared;
+};
+
+// An object whose shared count became negative
+struct fyr_brc_node {
+    struct fyr_brc_node* next;
+    addr_t ptr;
+    bool arr;
+    fyr_dtr_t dtr;
+    fyr_dtr_arr_t dtr_arr;
+};
+
+// Thread ids start at 1. Zero means that no thread has been assigned yet.
+static __thread uint32_t fyr_brc_tid;
+// Objects queued for their owner, indexed by thread id
+static struct fyr_brc_node* fyr_brc_queues[FYR_BRC_MAX_THREADS];
+// Protects all of the following
+static pthread_mutex_t fyr_brc_ids_lock = PTHREAD_MUTEX_INITIALIZER;
+// The highest thread id assigned so far
+static uint32_t fyr_brc_threads;
+// Ids of exited threads, which are assigned again
+static uint32_t fyr_brc_free_ids[FYR_BRC_MAX_THREADS];
+static uint32_t fyr_brc_free_count;
+// Its destructor returns the id of an exiting thread
+static pthread_key_t fyr_brc_key;
+static pthread_once_t fyr_brc_key_once = PTHREAD_ONCE_INIT;
+
+static void fyr_brc_exit(void* arg) {
+    pthread_mutex_lock(&fyr_brc_ids_lock);
+    fyr_brc_free_ids[fyr_brc_free_count++] = (uint32_t)(uintptr_t)arg;
+    pthread_mutex_unlock(&fyr_brc_ids_lock);
+    // Destructors of other thread-local data might still release objects. They must obtain a new id.
+    fyr_brc_tid = 0;
+}
+
+static void fyr_brc_create_key(void) {
+    if (pthread_key_create(&fyr_brc_key, fyr_brc_exit) != 0) {
+        fprintf(stderr, "fyr: Could not create the thread key for biased reference counting\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static __attribute__((noinline)) uint32_t fyr_brc_assign(void) {
+    pthread_once(&fyr_brc_key_once, fyr_brc_create_key);
+    uint32_t tid = 0;
+    pthread_mutex_lock(&fyr_brc_ids_lock);
+    if (fyr_brc_free_count > 0) {
+        tid = fyr_brc_free_ids[--fyr_brc_free_count];
+    } else if (fyr_brc_threads + 1 < FYR_BRC_MAX_THREADS) {
+        tid = ++fyr_brc_threads;
+    }
+    pthread_mutex_unlock(&fyr_brc_ids_lock);
+    if (tid == 0) {
+        fprintf(stderr, "fyr: More than %d threads are running, which is the limit of biased reference counting\n", FYR_BRC_MAX_THREADS - 1);
+        exit(EXIT_FAILURE);
+    }
+    pthread_setspecific(fyr_brc_key, (void*)(uintptr_t)tid);
+    fyr_brc_tid = tid;
+    return tid;
+}
+
+static inline uint32_t fyr_brc_self(void) {
+    if (__builtin_expect(fyr_brc_tid == 0, 0)) {
+        return fyr_brc_assign();
+    }
+    return fyr_brc_tid;
+}
+
+static inline struct fyr_brc* fyr_brc_of(addr_t ptr) {
+    return (struct fyr_brc*)(((int_t*)ptr) - 4);
+}
+
+static inline bool fyr_brc_owned(addr_t ptr) {
+    return __atomic_load_n(&fyr_brc_of(ptr)->owner, __ATOMIC_RELAXED) == fyr_brc_self();
+}
+
+/**
+ * Called by the owner when it holds no reference and no lock any more.
+ * Returns true if the caller must free the object, because no other thread holds a reference.
+ * Otherwise, the thread releasing the last shared reference frees the object.
+ * In this case, a destructor runs only if the reference count in the header is still zero.
+ */
+static bool fyr_brc_release(addr_t ptr) {
+    struct fyr_brc* b = fyr_brc_of(ptr);
+    // No other thread has ever seen the object. It cannot obtain a reference now.
+    if (__atomic_load_n(&b->shared, __ATOMIC_ACQUIRE) == 0) {
+        return true;
+    }
+    __atomic_store_n(&b->owner, 0, __ATOMIC_RELAXED);
+    int32_t old = __atomic_fetch_or(&b->shared, FYR_BRC_MERGED, __ATOMIC_ACQ_REL);
+    // A queued object is freed by fyr_brc_drain
+    return old == 0;
+}
+
+static void fyr_brc_finalize(addr_t ptr, bool arr, fyr_dtr_t dtr, fyr_dtr_arr_t dtr_arr) {
+    int_t* lptr = ((int_t*)ptr) - 2;
+    int_t* iptr = ((int_t*)ptr) - 1;
+    // Static data is locked forever
+    if (*lptr != 0) {
+        return;
+    }
+    // The owning pointer has been frozen. Hence, the destructor has not yet run.
+    if (*iptr == 0) {
+        if (arr) {
+            if (dtr_arr) dtr_arr(ptr, *FYR_ARR_COUNT(ptr));
+        } else if (dtr) {
+            dtr(ptr);
+        }
+    }
+    fyr_mem_free(((int_t*)ptr) - FYR_HEADER - (arr ? 1 : 0));
+}
+
+static void fyr_brc_decref(addr_t ptr, bool arr, fyr_dtr_t dtr, fyr_dtr_arr_t dtr_arr) {
+    struct fyr_brc* b = fyr_brc_of(ptr);
+    int32_t v = __atomic_sub_fetch(&b->shared, FYR_BRC_ONE, __ATOMIC_ACQ_REL);
+    if (v == FYR_BRC_MERGED) {
+        fyr_brc_finalize(ptr, arr, dtr, dtr_arr);
+    } else if (v < 0 && (v & (FYR_BRC_MERGED | FYR_BRC_QUEUED)) == 0) {
+        if (__atomic_fetch_or(&b->shared, FYR_BRC_QUEUED, __ATOMIC_ACQ_REL) & FYR_BRC_QUEUED) {
+            return;
+        }
+        // The count is negative. Hence, the owner still holds a reference and has not released the object.
+        uint32_t owner = __atomic_load_n(&b->owner, __ATOMIC_RELAXED);
+        struct fyr_brc_node* n = malloc(sizeof(struct fyr_brc_node));
+        if (n == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        n->ptr = ptr;
+        n->arr = arr;
+        n->dtr = dtr;
+        n->dtr_arr = dtr_arr;
+        n->next = __atomic_load_n(&fyr_brc_queues[owner], __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&fyr_brc_queues[owner], &n->next, n, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+// Applies the checks of fyr_decref after the owner has changed its reference count.
+static void fyr_brc_check(struct fyr_brc_node* n) {
+    int_t* lptr = ((int_t*)n->ptr) - 2;
+    int_t* iptr = ((int_t*)n->ptr) - 1;
+    if ((*iptr == 0 || *iptr == INT_MIN) && *lptr == 0 && fyr_brc_release(n->ptr)) {
+        if (*iptr == 0) {
+            if (n->arr) {
+                if (n->dtr_arr) n->dtr_arr(n->ptr, *FYR_ARR_COUNT(n->ptr));
+            } else if (n->dtr) {
+                n->dtr(n->ptr);
+            }
+        }
+        fyr_mem_free(((int_t*)n->ptr) - FYR_HEADER - (n->arr ? 1 : 0));
+    }
+}
+
+/**
+ * Runs destructors of queued objects. Hence, it is called at yield points only, never by fyr_alloc.
+ */
+void fyr_brc_drain(void) {
+    uint32_t self = fyr_brc_self();
+    if (__atomic_load_n(&fyr_brc_queues[self], __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    struct fyr_brc_node* n = __atomic_exchange_n(&fyr_brc_queues[self], NULL, __ATOMIC_ACQUIRE);
+    while (n != NULL) {
+        struct fyr_brc* b = fyr_brc_of(n->ptr);
+        int32_t v = __atomic_load_n(&b->shared, __ATOMIC_ACQUIRE);
+        for(;;) {
+            if (v & FYR_BRC_MERGED) {
+                if (__atomic_compare_exchange_n(&b->shared, &v, v & ~FYR_BRC_QUEUED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    if ((v & ~FYR_BRC_QUEUED) == FYR_BRC_MERGED) {
+                        fyr_brc_finalize(n->ptr, n->arr, n->dtr, n->dtr_arr);
+                    }
+                    break;
+                }
+            } else if (__atomic_compare_exchange_n(&b->shared, &v, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                // Move the shared count to the owner
+                *(((int_t*)n->ptr) - 1) += v >> 2;
+                fyr_brc_check(n);
+                break;
+            }
+        }
+        struct fyr_brc_node* next = n->next;
+        free(n);
+        n = next;
+    }
+}
+
+bool fyr_sole_ref(addr_t ptr) {
+    return *(((int_t*)ptr) - 1) == 1 && *(((int_t*)ptr) - 2) == 0 && __atomic_load_n(&fyr_brc_of(ptr)->shared, __ATOMIC_ACQUIRE) == 0;
+}
+
+#else
+
+#define fyr_brc_release(ptr) true
+
+void fyr_brc_drain(void) {
+}
+
+bool fyr_sole_ref(addr_t ptr) {
+    return *(((int_t*)ptr) - 1) == 1 && *(((int_t*)ptr) - 2) == 0;
+}
+
+#endif
+
+/**
+ * Initializes the header in front of 'ptr'.
+ */
+static inline addr_t fyr_init_header(int_t* ptr) {
+#ifdef FYR_BIASED_RC
+    // Owner
+    *ptr++ = (int_t)fyr_brc_self();
+    // No references of other threads
+    *ptr++ = 0;
+#endif
     // No locks
     *ptr++ = 0;
     // One owner
@@ -18,16 +497,38 @@ addr_t fyr_alloc(int_t size) {
     return (addr_t)ptr;
 }
 
+addr_t fyr_alloc(int_t size) {
+    // TODO: If int_t is larger than size_t, the size could be shortened.
+    int_t* ptr = fyr_mem_alloc((size_t)size + FYR_HEADER * sizeof(int_t));
+    // printf("calloc %lx\n", (long)ptr);
+    return fyr_init_header(ptr);
+}
+
 addr_t fyr_alloc_arr(int_t count, int_t size) {
-    int_t* ptr = calloc(1, (size_t)count * (size_t)size + 3 * sizeof(int_t));
+    int_t* ptr = fyr_mem_alloc((size_t)count * (size_t)size + (FYR_HEADER + 1) * sizeof(int_t));
     // printf("calloc arr %lx\n", (long)ptr);
     // Number of elements in the array
     *ptr++ = count;
-    // No locks
-    *ptr++ = 0;
-    // One owner
-    *ptr++ = 1;
-    return (addr_t)ptr;
+    return fyr_init_header(ptr);
+}
+
+// Strings of up to FYR_STR_SMALL bytes are all allocated with the same size.
+// Thus, they share one size class and its free list, which is determined at compile time.
+#define FYR_STR_SMALL 15
+#define FYR_STR_SMALL_SIZE ((FYR_HEADER + 1) * sizeof(int_t) + FYR_STR_SMALL + 1)
+
+addr_t fyr_alloc_str(int_t len) {
+    int_t* ptr;
+    if (len <= FYR_STR_SMALL) {
+        ptr = fyr_mem_alloc_raw(FYR_STR_SMALL_SIZE);
+    } else {
+        ptr = fyr_mem_alloc_raw((size_t)len + 1 + (FYR_HEADER + 1) * sizeof(int_t));
+    }
+    // Number of bytes including the trailing zero
+    *ptr++ = len + 1;
+    addr_t str = fyr_init_header(ptr);
+    str[len] = 0;
+    return str;
 }
 
 void fyr_free(addr_t ptr, fyr_dtr_t dtr) {
@@ -38,6 +539,8 @@ void fyr_free(addr_t ptr, fyr_dtr_t dtr) {
     int_t* lptr = ((int_t*)ptr) - 2;
     // Get reference count
     int_t* iptr = ((int_t*)ptr) - 1;
+    // Pointer to the allocated area
+    void* mem = ((int_t*)ptr) - FYR_HEADER;
     // Only one reference remaining? -> object can be destroyed (unless it is locked)
     if (*iptr == 1) {
         // printf("Free %lx\n", (long)iptr);
@@ -45,23 +548,21 @@ void fyr_free(addr_t ptr, fyr_dtr_t dtr) {
         if (*lptr == 0) {            
             // No one holds a lock on it.
             if (dtr) dtr(ptr);
-            free(lptr);
+            *iptr = INT_MIN;
+            if (fyr_brc_release(ptr)) {
+                fyr_mem_free(mem);
+            }
         } else {
             *iptr = 0;
         }
     } else {
-        // printf("REALLOC %lx %lx\n", (long)*iptr, (long)(INT_MIN + *iptr - 1));
-        // References exist. Decrease the reference count and realloc.
+        // References exist. Decrease the reference count and shrink the memory to its header.
         // The remaining memory does not need to be destructed.
-        *iptr = INT_MIN + *iptr - 1;        
-        // TODO: Use implementation of realloc that ensures that data does not move while shrinking
+        *iptr = INT_MIN + *iptr - 1;
         if (*lptr == 0) {
+            // No one holds a lock on it.
             if (dtr) dtr(ptr);
-#ifndef VALGRIND
-            // No one holds a lock on it.    
-            void* ignore = realloc(lptr, 2 * sizeof(int_t));
-            assert(ignore == lptr);
-#endif
+            fyr_mem_shrink(mem, FYR_HEADER * sizeof(int_t));
         }
     }
 }
@@ -76,26 +577,28 @@ void fyr_free_arr(addr_t ptr, fyr_dtr_arr_t dtr) {
     // Get reference count
     int_t* iptr = ((int_t*)ptr) - 1;
     // Pointer to the allocated area
-    void* mem = ((int_t*)ptr) - 3;
+    void* mem = FYR_ARR_COUNT(ptr);
     // Only one reference remaining? -> object can be destroyed (unless it is locked)
     if (*iptr == 1) {
         // Memory is not locked?
         if (*lptr == 0) {            
-            if (dtr) dtr(ptr, *(((int_t*)ptr) - 3));
-            free(mem);
+            if (dtr) dtr(ptr, *FYR_ARR_COUNT(ptr));
+            *iptr = INT_MIN;
+            if (fyr_brc_release(ptr)) {
+                fyr_mem_free(mem);
+            }
         } else {
             *iptr = 0;
         }
     } else {
-        // References exist. Decrease the reference count and realloc.
+        // References exist. Decrease the reference count and shrink the memory to its header.
         // The remaining memory does not need to be destructed.
         *iptr = INT_MIN + *iptr - 1;
-        // TODO: Use implementation of realloc that ensures that data does not move while shrinkink
-        if (dtr) dtr(ptr, *(((int_t*)ptr) - 3)); 
-#ifndef VALGRIND
-        void* ignore = realloc(mem, 3*sizeof(int_t));
-        assert(ignore == mem);
-#endif
+        if (*lptr == 0) {
+            // No one holds a lock on it. Otherwise fyr_unlock_arr destructs and shrinks the array.
+            if (dtr) dtr(ptr, *FYR_ARR_COUNT(ptr));
+            fyr_mem_shrink(mem, (FYR_HEADER + 1) * sizeof(int_t));
+        }
     }
 }
 
@@ -129,6 +632,12 @@ addr_t fyr_incref(addr_t ptr) {
     if (ptr == NULL) {
         return NULL;
     }
+#ifdef FYR_BIASED_RC
+    if (!fyr_brc_owned(ptr)) {
+        __atomic_add_fetch(&fyr_brc_of(ptr)->shared, FYR_BRC_ONE, __ATOMIC_RELAXED);
+        return ptr;
+    }
+#endif
     int_t* iptr = ((int_t*)ptr) - 1;
     (*iptr)++;
     return ptr;
@@ -138,30 +647,46 @@ void fyr_decref(addr_t ptr, fyr_dtr_t dtr) {
     if (ptr == NULL) {
         return;
     }
-    // Number of locks
-    int_t* lptr = ((int_t*)ptr) - 2;
+#ifdef FYR_BIASED_RC
+    if (!fyr_brc_owned(ptr)) {
+        fyr_brc_decref(ptr, false, dtr, NULL);
+        return;
+    }
+#endif
     // Number of references
     int_t* iptr = ((int_t*)ptr) - 1;
     // printf("DECREF %lx\n", (long)*iptr);
     (*iptr)--;
+    if (*iptr == 0 || *iptr == INT_MIN) {
+        fyr_decref_release(ptr, dtr);
+    }
+}
+
+void fyr_decref_release(addr_t ptr, fyr_dtr_t dtr) {
+    // Number of locks
+    int_t* lptr = ((int_t*)ptr) - 2;
+    // Number of references
+    int_t* iptr = ((int_t*)ptr) - 1;
+    // Pointer to the allocated area
+    void* mem = ((int_t*)ptr) - FYR_HEADER;
     if (*iptr == 0) {
         // Reference count can drop to zero only when the owning pointer has been assigned
         // to a frozen pointer and all references have been removed.
         // Hence, a destructor must run (unless the objec is locked).
-        if (*lptr == 0) {
+        if (*lptr == 0 && fyr_brc_release(ptr)) {
             if (dtr) dtr(ptr);
             // printf("DECREF FREE %lx\n", (long)iptr);
-            free(lptr);
+            fyr_mem_free(mem);
         }
     } else if (*iptr == INT_MIN) {
         // printf("Min count reached\n");
         // The owning pointer is gone, and all references are gone, too.
         // Finally, release all memory, unless someone is holding a lock on the memory
-        if (*lptr == 0) {
+        if (*lptr == 0 && fyr_brc_release(ptr)) {
             // printf("Free refcounter\n");
             // The owning pointer is zero (no freeze) and now all remaining references have been removed.
             // printf("DECREF FREE %lx\n", (long)iptr);
-            free(lptr);
+            fyr_mem_free(mem);
         }
     }
 }
@@ -170,24 +695,37 @@ void fyr_decref_arr(addr_t ptr, fyr_dtr_arr_t dtr) {
     if (ptr == NULL) {
         return;
     }
+#ifdef FYR_BIASED_RC
+    if (!fyr_brc_owned(ptr)) {
+        fyr_brc_decref(ptr, true, NULL, dtr);
+        return;
+    }
+#endif
+    // Number of references
+    int_t* iptr = ((int_t*)ptr) - 1;
+    if (--(*iptr) == 0 || *iptr == INT_MIN) {
+        fyr_decref_arr_release(ptr, dtr);
+    }
+}
 
+void fyr_decref_arr_release(addr_t ptr, fyr_dtr_arr_t dtr) {
     // Number of locks
     int_t* lptr = ((int_t*)ptr) - 2;
     // Number of references
     int_t* iptr = ((int_t*)ptr) - 1;
     // Pointer to the allocated area
-    void* mem = ((int_t*)ptr) - 3;
-    if (--(*iptr) == 0) {
+    void* mem = FYR_ARR_COUNT(ptr);
+    if (*iptr == 0) {
         // Reference count can drop to zero only when the owning pointer has been assigned
         // to a frozen pointer and all references have been removed.
         // Hence, a destructor must run.
-        if (*lptr == 0) {
-            if (dtr) dtr(ptr, *(((int_t*)ptr) - 3));
-            free(mem);
+        if (*lptr == 0 && fyr_brc_release(ptr)) {
+            if (dtr) dtr(ptr, *FYR_ARR_COUNT(ptr));
+            fyr_mem_free(mem);
         }
-    } else if (*iptr == INT_MIN) {
+    } else if (*iptr == INT_MIN && fyr_brc_release(ptr)) {
         // The owning pointer is zero (no freeze) and now all remaining references have been removed.
-        free(mem);
+        fyr_mem_free(mem);
     }
 }
 
@@ -207,16 +745,28 @@ void fyr_unlock(addr_t ptr, fyr_dtr_t dtr) {
     int_t* lptr = ((int_t*)ptr) - 2;
     int_t* iptr = ((int_t*)ptr) - 1;
     if (--(*lptr) == 0 && *iptr <= 0) {
-        if (*iptr == INT_MIN || *iptr == 0) {        
-            if (dtr) dtr(ptr);
-            free(lptr);
-        } else {
+        fyr_unlock_release(ptr, dtr);
+    }
+}
+
+void fyr_unlock_release(addr_t ptr, fyr_dtr_t dtr) {
+    int_t* iptr = ((int_t*)ptr) - 1;
+    // Pointer to the allocated area
+    void* mem = ((int_t*)ptr) - FYR_HEADER;
+    if (*iptr == 0) {
+        // Frozen and all references are gone, or the owning pointer has been released while locked
+        if (fyr_brc_release(ptr)) {
             if (dtr) dtr(ptr);
-#ifndef VALGRIND
-            void* ignore = realloc(lptr, 2 * sizeof(int_t));
-            assert(ignore == lptr);
-#endif
+            fyr_mem_free(mem);
         }
+    } else if (*iptr == INT_MIN) {
+        if (dtr) dtr(ptr);
+        if (fyr_brc_release(ptr)) {
+            fyr_mem_free(mem);
+        }
+    } else {
+        if (dtr) dtr(ptr);
+        fyr_mem_shrink(mem, FYR_HEADER * sizeof(int_t));
     }
 }
 
@@ -226,19 +776,29 @@ void fyr_unlock_arr(addr_t ptr, fyr_dtr_arr_t dtr) {
     }
     int_t* lptr = ((int_t*)ptr) - 2;
     int_t* iptr = ((int_t*)ptr) - 1;
-    // Pointer to the allocated area
-    void* mem = ((int_t*)ptr) - 3;
     if (--(*lptr) == 0 && *iptr <= 0) {
-        if (*iptr == INT_MIN || *iptr == 0) {
-            if (dtr) dtr(ptr, *(((int_t*)ptr) - 3));
-            free(mem);
-        } else {
-            if (dtr) dtr(ptr, *(((int_t*)ptr) - 3));
-#ifndef VALGRIND
-            void* ignore = realloc(mem, 3 * sizeof(int_t));
-            assert(ignore == mem);
-#endif
+        fyr_unlock_arr_release(ptr, dtr);
+    }
+}
+
+void fyr_unlock_arr_release(addr_t ptr, fyr_dtr_arr_t dtr) {
+    int_t* iptr = ((int_t*)ptr) - 1;
+    // Pointer to the allocated area
+    void* mem = FYR_ARR_COUNT(ptr);
+    if (*iptr == 0) {
+        // Frozen and all references are gone, or the owning pointer has been released while locked
+        if (fyr_brc_release(ptr)) {
+            if (dtr) dtr(ptr, *FYR_ARR_COUNT(ptr));
+            fyr_mem_free(mem);
+        }
+    } else if (*iptr == INT_MIN) {
+        if (dtr) dtr(ptr, *FYR_ARR_COUNT(ptr));
+        if (fyr_brc_release(ptr)) {
+            fyr_mem_free(mem);
         }
+    } else {
+        if (dtr) dtr(ptr, *FYR_ARR_COUNT(ptr));
+        fyr_mem_shrink(mem, (FYR_HEADER + 1) * sizeof(int_t));
     }
 }
 
@@ -246,7 +806,7 @@ int_t fyr_len_arr(addr_t ptr) {
     if (ptr == NULL) {
         return 0;
     }
-    return *(((int_t*)ptr)-3);
+    return *FYR_ARR_COUNT(ptr);
 }
 
 int_t fyr_len_str(addr_t ptr) {
@@ -254,7 +814,7 @@ int_t fyr_len_str(addr_t ptr) {
         return 0;
     }
     // -1, because the trailing 0 does not count
-    return (*(((int_t*)ptr)-3)) - 1;
+    return *FYR_ARR_COUNT(ptr) - 1;
 }
 
 int_t fyr_min(int_t a, int_t b) {
@@ -278,15 +838,103 @@ addr_t fyr_arr_to_str(addr_t array_ptr, addr_t data_ptr, int_t len) {
     if (array_ptr != data_ptr) {
         memmove(array_ptr, data_ptr, len);
     }
-    int *lenptr = ((int_t*)array_ptr)-3;
+    int *lenptr = FYR_ARR_COUNT(array_ptr);
     // Check for a trailing zero
     if (len >= *lenptr || ((char*)array_ptr)[len] != 0) {
         exit(EXIT_FAILURE);
     }
-    *lenptr = len;
+    // Like the count of fyr_alloc_str, the count of a string includes the trailing zero
+    *lenptr = len + 1;
     return array_ptr;
 }
 
+bool fyr_eq_str(addr_t str1, addr_t str2) {
+    if (str1 == str2) {
+        return true;
+    }
+    int_t len = fyr_len_str(str1);
+    return len == fyr_len_str(str2) && (len == 0 || memcmp(str1, str2, len) == 0);
+}
+
+/**
+ * Global table of interned strings with linear probing. It is shared by all threads and guarded by a spin lock.
+ *
+ * The table holds its own copies of the strings. Like string literals, these copies are locked forever.
+ * Hence, they are never freed and their reference counts do not matter, even if threads update them concurrently.
+ */
+static addr_t* fyr_intern_slots = NULL;
+static size_t fyr_intern_mask = 0;
+static size_t fyr_intern_count = 0;
+static bool fyr_intern_lock = false;
+
+static uint64_t fyr_intern_hash(addr_t str, size_t len) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ ((uint8_t*)str)[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void fyr_intern_resize(size_t capacity) {
+    addr_t* old = fyr_intern_slots;
+    size_t oldcap = old == NULL ? 0 : fyr_intern_mask + 1;
+    fyr_intern_slots = calloc(capacity, sizeof(addr_t));
+    if (fyr_intern_slots == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    fyr_intern_mask = capacity - 1;
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i] != NULL) {
+            size_t j = fyr_intern_hash(old[i], fyr_len_str(old[i])) & fyr_intern_mask;
+            while (fyr_intern_slots[j] != NULL) {
+                j = (j + 1) & fyr_intern_mask;
+            }
+            fyr_intern_slots[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+addr_t fyr_intern_str(addr_t str) {
+    int_t len = fyr_len_str(str);
+    uint64_t hash = fyr_intern_hash(str, len);
+    while (__atomic_test_and_set(&fyr_intern_lock, __ATOMIC_ACQUIRE)) {
+    }
+    // Keep the load factor below 1/2
+    if (fyr_intern_slots == NULL || 2 * (fyr_intern_count + 1) > fyr_intern_mask + 1) {
+        fyr_intern_resize(fyr_intern_slots == NULL ? 256 : 2 * (fyr_intern_mask + 1));
+    }
+    size_t i = hash & fyr_intern_mask;
+    addr_t s;
+    while (true) {
+        s = fyr_intern_slots[i];
+        if (s == NULL) {
+            s = fyr_alloc_str(len);
+            if (len != 0) {
+                memcpy(s, str, len);
+            }
+            // The lock keeps the copy alive forever
+            *(((int_t*)s) - 2) = 1;
+            fyr_intern_slots[i] = s;
+            fyr_intern_count++;
+            break;
+        }
+        if (fyr_eq_str(s, str)) {
+            break;
+        }
+        i = (i + 1) & fyr_intern_mask;
+    }
+    __atomic_clear(&fyr_intern_lock, __ATOMIC_RELEASE);
+#ifdef FYR_BIASED_RC
+    // Threads other than the owner count their reference atomically
+    return fyr_incref(s);
+#else
+    __atomic_add_fetch(((int_t*)s) - 1, 1, __ATOMIC_RELAXED);
+    return s;
+#endif
+}
+
 void fyr_move_arr(addr_t dest, addr_t source, int_t count, int_t size, fyr_dtr_arr_t dtr) {
     if (dest == source) {
         return;
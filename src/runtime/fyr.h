@@ -14,8 +14,26 @@ typedef uint32_t uint_t;
 typedef void (*fyr_dtr_t)(addr_t ptr);
 typedef void (*fyr_dtr_arr_t)(addr_t ptr, int_t count);
 
+#ifdef FYR_BIASED_RC
+// Header fields of biased reference counting which precede the number of locks, see fyr.c.
+#define FYR_BRC_FIELDS uint32_t brc_owner; int32_t brc_shared;
+// Static data has no owner and is never freed
+#define FYR_BRC_STATIC 0, 1,
+// Number of int_t in front of an object
+#define FYR_HEADER 4
+#else
+#define FYR_BRC_FIELDS
+#define FYR_BRC_STATIC
+// Number of int_t in front of an object: locks and references
+#define FYR_HEADER 2
+#endif
+// Pointer to the number of elements of an array, which precedes the header
+#define FYR_ARR_COUNT(ptr) (((int_t*)(ptr)) - FYR_HEADER - 1)
+
 addr_t fyr_alloc(int_t size);
 addr_t fyr_alloc_arr(int_t count, int_t size);
+// Allocates a string of 'len' bytes plus the trailing zero. Only the trailing zero is initialized.
+addr_t fyr_alloc_str(int_t len);
 void fyr_free(addr_t, fyr_dtr_t dtr);
 void fyr_free_arr(addr_t, fyr_dtr_arr_t dtr);
 bool fyr_isnull(addr_t);
@@ -24,16 +42,35 @@ addr_t fyr_incref(addr_t ptr);
 #define fyr_incref_arr fyr_incref
 void fyr_decref(addr_t ptr, fyr_dtr_t dtr);
 void fyr_decref_arr(addr_t ptr, fyr_dtr_arr_t dtr);
+// Slow paths of fyr_decref and fyr_decref_arr. Called by the owner after the reference count dropped to 0 or INT_MIN.
+void fyr_decref_release(addr_t ptr, fyr_dtr_t dtr);
+void fyr_decref_arr_release(addr_t ptr, fyr_dtr_arr_t dtr);
 addr_t fyr_lock(addr_t ptr);
 void fyr_unlock(addr_t ptr, fyr_dtr_t dtr);
 #define fyr_lock_arr fyr_lock
 void fyr_unlock_arr(addr_t ptr, fyr_dtr_arr_t dtr);
+// Slow paths of fyr_unlock and fyr_unlock_arr. Called after the last lock has been released from an object without owner.
+void fyr_unlock_release(addr_t ptr, fyr_dtr_t dtr);
+void fyr_unlock_arr_release(addr_t ptr, fyr_dtr_arr_t dtr);
 int_t fyr_len_arr(addr_t ptr);
 int_t fyr_len_str(addr_t ptr);
 int_t fyr_min(int_t a, int_t b);
 int_t fyr_max(int_t a, int_t b);
 addr_t fyr_arr_to_str(addr_t array_ptr, addr_t data_ptr, int_t len);
+// Returns true if both strings have the same bytes. A NULL string equals the empty string.
+// Identical pointers, e.g. equal interned strings, are equal without looking at the bytes.
+// Strings of different lengths are unequal without looking at the bytes. Otherwise, the bytes are compared.
+bool fyr_eq_str(addr_t str1, addr_t str2);
+// Returns the interned copy of the bytes of `str` and adds a reference to it. `str` itself is not released.
+// All threads share the interned copies, which are never freed. Hence, they must not be modified.
+// Equal interned strings have equal pointers. A NULL string yields the interned empty string.
+addr_t fyr_intern_str(addr_t str);
 void fyr_move_arr(addr_t dest, addr_t source, int_t count, int_t size, fyr_dtr_arr_t dtr);
 bool fyr_cmp_ref(addr_t ptr1, addr_t ptr2);
+// Returns true if the owning pointer is the only pointer to the object and the object is not locked.
+bool fyr_sole_ref(addr_t ptr);
+// Applies the reference counts released by other threads to the objects owned by this thread.
+// This has an effect only with biased reference counting.
+void fyr_brc_drain(void);
 
 #endif
\ No newline at end of file
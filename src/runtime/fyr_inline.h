@@ -0,0 +1,142 @@
+#ifndef FYR_INLINE_H
+#define FYR_INLINE_H
+
+/**
+ * Inline fast paths of the runtime functions declared in fyr.h.
+ *
+ * The C backend includes this header in every generated file, such that gcc can inline
+ * reference counting, locks, null checks, length operations and string equality without LTO.
+ * The macros below replace the calls to the out-of-line functions with calls to the inline versions.
+ * Slow paths, i.e. running destructors and freeing memory, remain out of line in fyr.c.
+ *
+ * Native code of packages may include fyr.h instead and call the out-of-line functions.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "fyr.h"
+
+#ifndef FYR_BIASED_RC
+// With biased reference counting, fyr_incref and fyr_decref check the owner thread. They remain out of line.
+
+static inline addr_t fyr_inline_incref(addr_t ptr) {
+    if (ptr != NULL) {
+        (*(((int_t*)ptr) - 1))++;
+    }
+    return ptr;
+}
+
+static inline void fyr_inline_decref(addr_t ptr, fyr_dtr_t dtr) {
+    if (ptr == NULL) {
+        return;
+    }
+    int_t* iptr = ((int_t*)ptr) - 1;
+    if (--(*iptr) == 0 || *iptr == INT_MIN) {
+        fyr_decref_release(ptr, dtr);
+    }
+}
+
+static inline void fyr_inline_decref_arr(addr_t ptr, fyr_dtr_arr_t dtr) {
+    if (ptr == NULL) {
+        return;
+    }
+    int_t* iptr = ((int_t*)ptr) - 1;
+    if (--(*iptr) == 0 || *iptr == INT_MIN) {
+        fyr_decref_arr_release(ptr, dtr);
+    }
+}
+
+#define fyr_incref(ptr) fyr_inline_incref(ptr)
+#define fyr_decref(ptr, dtr) fyr_inline_decref(ptr, dtr)
+#define fyr_decref_arr(ptr, dtr) fyr_inline_decref_arr(ptr, dtr)
+
+#endif
+
+static inline addr_t fyr_inline_lock(addr_t ptr) {
+    if (ptr != NULL) {
+        (*(((int_t*)ptr) - 2))++;
+    }
+    return ptr;
+}
+
+static inline void fyr_inline_unlock(addr_t ptr, fyr_dtr_t dtr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (--(*(((int_t*)ptr) - 2)) == 0 && *(((int_t*)ptr) - 1) <= 0) {
+        fyr_unlock_release(ptr, dtr);
+    }
+}
+
+static inline void fyr_inline_unlock_arr(addr_t ptr, fyr_dtr_arr_t dtr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (--(*(((int_t*)ptr) - 2)) == 0 && *(((int_t*)ptr) - 1) <= 0) {
+        fyr_unlock_arr_release(ptr, dtr);
+    }
+}
+
+static inline bool fyr_inline_isnull(addr_t ptr) {
+    return ptr == NULL || (*(((int_t*)ptr) - 1) <= 0 && *(((int_t*)ptr) - 2) == 0);
+}
+
+static inline void fyr_inline_notnull_ref(addr_t ptr) {
+    if (__builtin_expect(fyr_inline_isnull(ptr), 0)) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline bool fyr_inline_cmp_ref(addr_t ptr1, addr_t ptr2) {
+    if (ptr1 == ptr2) {
+        return true;
+    }
+    // A weak pointer to a destructed object is considered to be NULL
+    if (ptr1 == NULL) {
+        return *(((int_t*)ptr2) - 1) <= 0 && *(((int_t*)ptr2) - 2) == 0;
+    } else if (ptr2 == NULL) {
+        return *(((int_t*)ptr1) - 1) <= 0 && *(((int_t*)ptr1) - 2) == 0;
+    }
+    return false;
+}
+
+static inline int_t fyr_inline_len_arr(addr_t ptr) {
+    return ptr == NULL ? 0 : *FYR_ARR_COUNT(ptr);
+}
+
+static inline int_t fyr_inline_len_str(addr_t ptr) {
+    // -1, because the trailing 0 does not count
+    return ptr == NULL ? 0 : *FYR_ARR_COUNT(ptr) - 1;
+}
+
+static inline bool fyr_inline_eq_str(addr_t str1, addr_t str2) {
+    if (str1 == str2) {
+        return true;
+    }
+    int_t len = fyr_inline_len_str(str1);
+    return len == fyr_inline_len_str(str2) && (len == 0 || memcmp(str1, str2, len) == 0);
+}
+
+static inline int_t fyr_inline_min(int_t a, int_t b) {
+    return a < b ? a : b;
+}
+
+static inline int_t fyr_inline_max(int_t a, int_t b) {
+    return a > b ? a : b;
+}
+
+#define fyr_lock(ptr) fyr_inline_lock(ptr)
+#define fyr_unlock(ptr, dtr) fyr_inline_unlock(ptr, dtr)
+#define fyr_unlock_arr(ptr, dtr) fyr_inline_unlock_arr(ptr, dtr)
+#define fyr_isnull(ptr) fyr_inline_isnull(ptr)
+#define fyr_notnull_ref(ptr) fyr_inline_notnull_ref(ptr)
+#define fyr_cmp_ref(ptr1, ptr2) fyr_inline_cmp_ref(ptr1, ptr2)
+#define fyr_len_arr(ptr) fyr_inline_len_arr(ptr)
+#define fyr_len_str(ptr) fyr_inline_len_str(ptr)
+#define fyr_eq_str(str1, str2) fyr_inline_eq_str(str1, str2)
+#define fyr_min(a, b) fyr_inline_min(a, b)
+#define fyr_max(a, b) fyr_inline_max(a, b)
+
+#endif
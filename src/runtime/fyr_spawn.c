@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdint.h>
-#include <alloca.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "fyr.h"
 #include "fyr_spawn.h"
@@ -15,11 +16,302 @@ struct fyr_coro_t *fyr_ready2_first;
 struct fyr_coro_t *fyr_ready2_last;
 struct fyr_coro_t *fyr_waiting;
 struct fyr_coro_t *fyr_garbage_coro;
+struct fyr_scheduler_t fyr_scheduler;
+bool (*fyr_poller)(bool block);
+// Receives the stack pointer of coroutines that have finished. It is never switched to.
+static void *fyr_finished_sp;
 
-#define fyr_coro_STACKSIZE (16*1024)
+// The default stack size. Stacks are committed lazily, i.e. pages that are never touched do not consume memory.
+#define fyr_coro_STACKSIZE (64*1024)
+// The default number of finished coroutines each thread keeps for reuse
+#define FYR_CORO_POOL 256
+
+// A finished coroutine kept for reuse by the next spawn.
+// `coro` is NULL if references to the coroutine remained when it finished. Then only its stack can be reused.
+struct fyr_coro_pool_entry {
+    void *stack;
+    size_t size;
+    struct fyr_coro_t *coro;
+};
+
+// Each thread has its own pool, because threads running their own scheduler release coroutines concurrently.
+struct fyr_coro_pool {
+    int count;
+    int capacity;
+    struct fyr_coro_pool_entry *entries;
+};
+
+static __thread struct fyr_coro_pool fyr_pool;
+// The maximum number of entries in the pool of each thread. Can be set via the environment variable FYR_CORO_POOL.
+static int fyr_pool_limit = FYR_CORO_POOL;
+// Number of spawns that did or did not find a stack in the pool, see fyr_coro_pool_stats
+static uint64_t fyr_pool_hits;
+static uint64_t fyr_pool_misses;
+static size_t fyr_pagesize;
+
+// The context switch only saves the registers which the calling convention requires a function to preserve.
+// All other registers have already been saved by the caller of fyr_context_switch, if necessary.
+// The saved registers are pushed on the stack of the suspended context. Hence, a context is a stack pointer.
+#if defined(__x86_64__)
+__asm__(
+    ".text\n"
+    ".globl fyr_context_switch\n"
+    ".type fyr_context_switch, @function\n"
+    "fyr_context_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    // A ret would almost always be mispredicted, because the return stack of the CPU belongs to the other context.
+    "    popq %rcx\n"
+    "    jmp *%rcx\n"
+    ".size fyr_context_switch, .-fyr_context_switch\n"
+    // The first switch to a new context returns here. fyr_context_init stored entry in r12 and arg in r13.
+    ".type fyr_context_start, @function\n"
+    "fyr_context_start:\n"
+    "    movq %r13, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+    ".size fyr_context_start, .-fyr_context_start\n"
+);
+
+// Number of registers saved by fyr_context_switch
+#define FYR_CONTEXT_WORDS 6
+#define FYR_CONTEXT_ENTRY 3
+#define FYR_CONTEXT_ARG 2
+#elif defined(__aarch64__)
+__asm__(
+    ".text\n"
+    ".globl fyr_context_switch\n"
+    ".type fyr_context_switch, %function\n"
+    "fyr_context_switch:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size fyr_context_switch, .-fyr_context_switch\n"
+    // The first switch to a new context returns here. fyr_context_init stored entry in x19 and arg in x20.
+    ".type fyr_context_start, %function\n"
+    "fyr_context_start:\n"
+    "    mov x0, x20\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size fyr_context_start, .-fyr_context_start\n"
+);
+
+#define FYR_CONTEXT_WORDS 20
+#define FYR_CONTEXT_ENTRY 0
+#define FYR_CONTEXT_ARG 1
+#else
+#error "Coroutines are not supported on this architecture"
+#endif
+
+extern char fyr_context_start[];
+
+void* fyr_context_init(void *top, void (*entry)(void*), void *arg) {
+    // The stack must be aligned to 16 bytes when entry is called.
+    uintptr_t *sp = (uintptr_t*)((uintptr_t)top & ~(uintptr_t)15);
+#if defined(__x86_64__)
+    // The return address of fyr_context_switch
+    *--sp = (uintptr_t)fyr_context_start;
+    sp -= FYR_CONTEXT_WORDS;
+    for(int i = 0; i < FYR_CONTEXT_WORDS; i++) {
+        sp[i] = 0;
+    }
+#elif defined(__aarch64__)
+    sp -= FYR_CONTEXT_WORDS;
+    for(int i = 0; i < FYR_CONTEXT_WORDS; i++) {
+        sp[i] = 0;
+    }
+    // x30 is the return address of fyr_context_switch
+    sp[11] = (uintptr_t)fyr_context_start;
+#endif
+    sp[FYR_CONTEXT_ENTRY] = (uintptr_t)entry;
+    sp[FYR_CONTEXT_ARG] = (uintptr_t)arg;
+    return sp;
+}
+
+static size_t fyr_page_size(void) {
+    if (fyr_pagesize == 0) {
+        fyr_pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return fyr_pagesize;
+}
+
+// Returns a stack with `size` usable bytes, preceded by a guard page.
+// A stack overflow hits the guard page instead of silently corrupting the heap.
+static void* fyr_stack_alloc(size_t size) {
+    size_t page = fyr_page_size();
+    // MAP_NORESERVE: Physical memory is only committed for pages the coroutine actually touches.
+    void *stack = mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        exit(EXIT_FAILURE);
+    }
+    if (mprotect(stack, page, PROT_NONE) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    return stack;
+}
+
+// Removes an entry with a stack of `size` bytes from the pool of the calling thread.
+// Returns false if there is none.
+static bool fyr_pool_take(size_t size, struct fyr_coro_pool_entry *result) {
+    struct fyr_coro_pool *pool = &fyr_pool;
+    for(int i = pool->count - 1; i >= 0; i--) {
+        if (pool->entries[i].size == size) {
+            *result = pool->entries[i];
+            pool->count--;
+            pool->entries[i] = pool->entries[pool->count];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds an entry to the pool of the calling thread. Returns false if the pool is full.
+static bool fyr_pool_put(void *stack, size_t size, struct fyr_coro_t *coro) {
+    struct fyr_coro_pool *pool = &fyr_pool;
+    if (pool->count >= fyr_pool_limit) {
+        return false;
+    }
+    if (pool->count == pool->capacity) {
+        int capacity = pool->capacity == 0 ? 16 : 2 * pool->capacity;
+        if (capacity > fyr_pool_limit) {
+            capacity = fyr_pool_limit;
+        }
+        struct fyr_coro_pool_entry *entries = realloc(pool->entries, capacity * sizeof(struct fyr_coro_pool_entry));
+        if (entries == NULL) {
+            return false;
+        }
+        pool->entries = entries;
+        pool->capacity = capacity;
+    }
+    pool->entries[pool->count].stack = stack;
+    pool->entries[pool->count].size = size;
+    pool->entries[pool->count].coro = coro;
+    pool->count++;
+    return true;
+}
+
+void fyr_coro_free(struct fyr_coro_t *c) {
+    // Without any lock or further reference, nobody can observe that the coroutine is reused.
+    bool unique = fyr_sole_ref((addr_t)c);
+    if (fyr_pool_put(c->stack, c->stack_size, unique ? c : NULL)) {
+        if (!unique) {
+            fyr_free((addr_t)c, NULL);
+        }
+        return;
+    }
+    munmap(c->stack, c->stack_size + fyr_page_size());
+    fyr_free((addr_t)c, NULL);
+}
+
+void fyr_coro_pool_init(void) {
+    char *env = getenv("FYR_CORO_POOL");
+    fyr_pool_limit = FYR_CORO_POOL;
+    if (env != NULL) {
+        long n = strtol(env, NULL, 10);
+        if (n >= 0 && n <= INT32_MAX) {
+            fyr_pool_limit = (int)n;
+        }
+    }
+}
+
+void fyr_coro_pool_stats(uint64_t *hits, uint64_t *misses) {
+    *hits = __atomic_load_n(&fyr_pool_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&fyr_pool_misses, __ATOMIC_RELAXED);
+}
+
+// Frees the coroutine that finished before the last context switch.
+// Doing that before was not possible, because a coroutine cannot delete the stack it operates on.
+static void fyr_collect_garbage(void) {
+    if (fyr_garbage_coro) {
+//        printf("Free ...\n");
+        fyr_coro_free(fyr_garbage_coro);
+        fyr_garbage_coro = NULL;
+    }
+}
+
+static void fyr_coro_run(void *arg) {
+    struct fyr_coro_t *c = (struct fyr_coro_t*)arg;
+    // A new coroutine does not return from fyr_context_switch. Hence, it must collect the garbage here.
+    fyr_collect_garbage();
+    c->entry(c);
+}
+
+struct fyr_coro_t* fyr_coro_new(void (*entry)(struct fyr_coro_t*), int argsize, int stacksize) {
+    size_t page = fyr_page_size();
+    size_t size = stacksize > 0 ? (size_t)stacksize : fyr_coro_STACKSIZE;
+    size = (size + page - 1) & ~(page - 1);
+    struct fyr_coro_t *c = NULL;
+    struct fyr_coro_pool_entry e;
+    if (fyr_pool_take(size, &e)) {
+        __atomic_add_fetch(&fyr_pool_hits, 1, __ATOMIC_RELAXED);
+        if (e.coro != NULL && e.coro->argsize >= argsize) {
+            // Reuse the coroutine without clearing it. Its arguments are overwritten by the caller anyway.
+            c = e.coro;
+            c->prev = NULL;
+            c->next = NULL;
+        } else {
+            fyr_free((addr_t)e.coro, NULL);
+        }
+    } else {
+        __atomic_add_fetch(&fyr_pool_misses, 1, __ATOMIC_RELAXED);
+        e.stack = fyr_stack_alloc(size);
+    }
+    if (c == NULL) {
+        c = (struct fyr_coro_t*)fyr_alloc(sizeof(struct fyr_coro_t) + argsize);
+        c->argsize = argsize;
+    }
+    c->stack = e.stack;
+    c->stack_size = size;
+    c->entry = entry;
+    c->sp = fyr_context_init((char*)c->stack + page + size, fyr_coro_run, c);
+    return c;
+}
+
+static struct fyr_coro_t* fyr_running_coro(void) {
+    return fyr_running;
+}
 
 void fyr_component_main_start(void) {
-    fyr_main_coro.memory = NULL;
+    fyr_coro_pool_init();
+    fyr_scheduler.running = fyr_running_coro;
+    fyr_scheduler.yield = fyr_yield;
+    fyr_scheduler.resume = fyr_resume;
+    fyr_main_coro.stack = NULL;
     fyr_main_coro.next = NULL;
     fyr_running = &fyr_main_coro;
     fyr_ready_first = NULL;
@@ -30,106 +322,133 @@ void fyr_component_main_start(void) {
     fyr_garbage_coro = NULL;
 }
 
+// Saves the context of the running coroutine in *save and continues the next coroutine that is ready.
+static void fyr_switch_next(void **save) {
+    // Look in both ready lists.
+    if (fyr_ready_first != NULL) {
+        fyr_running = fyr_ready_first;
+        if (fyr_ready_first == fyr_ready_last) {
+            // The ready list is now empty
+            fyr_ready_first = NULL;
+            fyr_ready_last = NULL;
+        } else {
+            fyr_ready_first = fyr_ready_first->next;
+        }
+    } else {
+        fyr_running = fyr_ready2_first;
+        if (fyr_ready2_first == fyr_ready2_last) {
+            // The ready2 list is now empty
+            fyr_ready2_first = NULL;
+            fyr_ready2_last = NULL;
+        } else {
+            fyr_ready2_first = fyr_ready2_first->next;
+        }
+    }
+//    printf("CORO running %p, main is %p\n", fyr_running, &fyr_main_coro);
+    fyr_running->next = NULL;
+    if (save == &fyr_running->sp) {
+        // The coroutine has been resumed while it was polling for events. It just continues.
+        return;
+    }
+    fyr_context_switch(save, fyr_running->sp);
+    // When we are here, the coroutine that saved its context in *save is resumed.
+    fyr_collect_garbage();
+}
+
+// True if no coroutine is ready to run
+static inline bool fyr_idle(void) {
+    return fyr_ready_first == NULL && fyr_ready2_first == NULL;
+}
+
 void fyr_component_main_end(void) {
     // The main coroutine has finished.
     fyr_running = NULL;
-    // Set a jump such that fyr_yield can return to this point.
-    if (!setjmp(fyr_main_coro.buf)) {
-        // If there are other coroutines waiting to be executed, then execute them.
-        // This yield will not return. It will jump to the position we set before.
-        fyr_yield(true);
-    }
-    // We are here, because fyr_yield decided that there are no more coroutines left.
-    //
-    // The previous coroutine finished? Garbage collect it now.
-    // Doing that before was not possible, because a coroutine cannot delete the stack it operates on.
-    if (fyr_garbage_coro) {
-//        printf("Free ...\n");
-        fyr_free(fyr_garbage_coro->memory, NULL);
-        fyr_garbage_coro = NULL;
+    // Wait until the event loop, if any, resumes a waiting coroutine.
+    while (fyr_idle() && fyr_waiting != NULL && fyr_poller != NULL && fyr_poller(true)) {
     }
+    if (!fyr_idle()) {
+        // Execute the other coroutines.
+        // When no coroutine is left, fyr_yield switches back to this point.
+        fyr_switch_next(&fyr_main_coro.sp);
+    } else if (fyr_waiting != NULL) {
+        // There are coroutines left, but all are waiting. This is a deadlock.
+        exit(1);
+    }
+    // We are here, because no more coroutines are left.
+    fyr_collect_garbage();
 }
 
 void fyr_yield(bool wait) {
 //    printf("yield ... %p\n", fyr_running);
-    if (fyr_running) {
-        if (setjmp(fyr_running->buf)) {
-            // The previous coroutine finished? Garbage collect it now.
-            // Doing that before was not possible because a coroutine cannot delete the stack it operates on.
-            if (fyr_garbage_coro) {
-//                printf("Free ...\n");
-                fyr_free(fyr_garbage_coro->memory, NULL);
-                fyr_garbage_coro = NULL;
-            }
-            // When we are here, the yielding coroutine is resumed.
-            return;
-        }
-    }
-    if (fyr_ready_first == NULL && fyr_ready2_first == NULL) {
+#ifdef FYR_BIASED_RC
+    // Objects released by other threads. Destructors may run here, but not when allocating.
+    fyr_brc_drain();
+#endif
+    if (fyr_idle() && !wait) {
         // All other coroutines are waiting to be resumed, only the yielding coroutine can continue?
-        // Then continue the yielding coroutine.
-        if (!wait) {
+        // Then continue the yielding coroutine, unless the event loop resumes another one.
+        if (fyr_poller == NULL || !fyr_poller(false) || fyr_idle()) {
             return;
         }
-        if (fyr_waiting != NULL || fyr_running != NULL) {
-            // There are coroutines left, but all are waiting. This is a deadlock.
-            exit(1);
-        }
-        // There are no coroutines left.
-        // This implies that the main coroutine must have completed and fyr_component_main_end has been called.
-        // Jump there.
-        longjmp(fyr_main_coro.buf, 1);
     }
     // Put the current co-routine in the waiting or ready list.
     // Do nothing like that if the current coroutine has finished (i.e. fyr_running == NULL).
-    if (fyr_running) {
+    struct fyr_coro_t *c = fyr_running;
+    if (c) {
         if (wait) {
             // Add the current coroutine to the waiting list
-            fyr_running->next = fyr_waiting;
+            c->next = fyr_waiting;
             if (fyr_waiting != NULL) {
-                fyr_waiting->prev = fyr_running;
+                fyr_waiting->prev = c;
             }
-            fyr_waiting = fyr_running;
+            fyr_waiting = c;
         } else {
             // Add the current coroutine at the end of the ready2 list.
             if (fyr_ready2_first == NULL) {
-                fyr_ready2_first = fyr_running;
-                fyr_ready2_last = fyr_running;
+                fyr_ready2_first = c;
+                fyr_ready2_last = c;
             } else {
-                fyr_ready2_last->next = fyr_running;
-                fyr_ready2_last = fyr_running;
+                fyr_ready2_last->next = c;
+                fyr_ready2_last = c;
             }
         }
     }
-    // Execute the next coroutine that is ready.
-    // Look in both ready lists.
-    if (fyr_ready_first != NULL) {
-        fyr_running = fyr_ready_first;
-        if (fyr_ready_first == fyr_ready_last) {
-            // The ready list is now empty
-            fyr_ready_first = NULL;
-            fyr_ready_last = NULL;
-        } else {
-            fyr_ready_first = fyr_ready_first->next;
-        }
-    } else {
-        fyr_running = fyr_ready2_first;
-        if (fyr_ready2_first == fyr_ready2_last) {
-            // The ready2 list is now empty
-            fyr_ready2_first = NULL;
-            fyr_ready2_last = NULL;
-        } else {
-            fyr_ready2_first = fyr_ready2_first->next;
+    // The current coroutine is already in the waiting list, because the event loop might resume it.
+    while (fyr_idle() && fyr_poller != NULL && fyr_poller(true)) {
+    }
+    if (fyr_idle()) {
+        if (fyr_waiting != NULL) {
+            // There are coroutines left, but all are waiting. This is a deadlock.
+            exit(1);
         }
+        // There are no coroutines left.
+        // This implies that the main coroutine must have completed and fyr_component_main_end has been called.
+        // Switch there.
+        fyr_context_switch(&fyr_finished_sp, fyr_main_coro.sp);
     }
-//    printf("CORO running %p, main is %p\n", fyr_running, &fyr_main_coro);
-    fyr_running->next = NULL;
-//    printf("Jumping ...\n");
-    longjmp(fyr_running->buf, 1);    
+    // Execute the next coroutine that is ready.
+    fyr_switch_next(c ? &c->sp : &fyr_finished_sp);
+}
+
+void fyr_spawn(struct fyr_coro_t *c) {
+    // The new coroutine is executed next
+    c->next = fyr_ready_first;
+    fyr_ready_first = c;
+    if (fyr_ready_last == NULL) {
+        fyr_ready_last = c;
+    }
+}
+
+void fyr_exit(void) {
+    fyr_garbage_coro = fyr_running;
+    fyr_running = NULL;
+    fyr_yield(true);
+    // Not reached, because a finished coroutine is never resumed.
+    abort();
 }
 
 int fyr_stacksize() {
-    return fyr_coro_STACKSIZE + sizeof(struct fyr_coro_t);
+    return fyr_coro_STACKSIZE;
 }
 
 void fyr_resume(struct fyr_coro_t *c) {
@@ -139,14 +458,14 @@ void fyr_resume(struct fyr_coro_t *c) {
         if (c->next != NULL) {
             c->next->prev = NULL;
             c->next = NULL;
-        }    
+        }
     } else if (c->prev != NULL) {
         // The coroutine is in a double linked list? This must be the waiting list.
         c->prev->next = c->next;
         if (c->next != NULL) {
             c->next->prev = c->prev;
             c->next = NULL;
-        }    
+        }
         c->prev = NULL;
     } else {
         // The coroutine is not in the waiting list. Do nothing.
@@ -158,7 +477,7 @@ void fyr_resume(struct fyr_coro_t *c) {
         fyr_ready_first = c;
     } else {
         fyr_ready_last->next = c;
-        fyr_ready2_last = c;
+        fyr_ready_last = c;
     }
 }
 
@@ -2,13 +2,23 @@
 #define FYR_SPAWN
 
 #include <stdbool.h>
-#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct fyr_coro_t {
-    void* memory;
+    // The mapping holding the stack of the coroutine. Its lowest page is a guard page.
+    // NULL for the main coroutine, which runs on the stack of the thread.
+    void* stack;
+    // Usable size of the stack, excluding the guard page
+    size_t stack_size;
+    // Number of bytes reserved for the arguments, see fyr_coro_new
+    int argsize;
     struct fyr_coro_t *prev;
     struct fyr_coro_t *next;
-    jmp_buf buf;
+    // The saved stack pointer of a suspended coroutine, see fyr_context_switch
+    void *sp;
+    // The function executed by the coroutine
+    void (*entry)(struct fyr_coro_t*);
 };
 
 extern struct fyr_coro_t fyr_main_coro;
@@ -24,5 +34,43 @@ void fyr_yield(bool);
 int fyr_stacksize();
 void fyr_resume(struct fyr_coro_t *coro);
 struct fyr_coro_t* fyr_coroutine(void);
+// Allocates a coroutine which executes `entry` once it is scheduled.
+// `argsize` bytes directly following the fyr_coro_t are reserved for the arguments of the coroutine.
+// `stacksize` is the requested size of its stack in bytes or 0 for the default size.
+struct fyr_coro_t* fyr_coro_new(void (*entry)(struct fyr_coro_t*), int argsize, int stacksize);
+// Releases a coroutine that has finished. Must not be called on the stack of that coroutine.
+// The coroutine and its stack are kept in a pool for reuse by fyr_coro_new.
+void fyr_coro_free(struct fyr_coro_t *coro);
+// Reads the size of the coroutine pool from the environment variable FYR_CORO_POOL. The default is 256.
+void fyr_coro_pool_init(void);
+// Returns how often fyr_coro_new found a stack in the pool and how often it had to allocate one.
+void fyr_coro_pool_stats(uint64_t *hits, uint64_t *misses);
+// Adds a new coroutine to the ready list.
+void fyr_spawn(struct fyr_coro_t *coro);
+// Called by a coroutine that has finished. Does not return.
+void fyr_exit(void) __attribute__((noreturn));
 
-#endif
\ No newline at end of file
+// Lets code outside of the scheduler, e.g. an event loop, suspend and resume coroutines.
+// Set by fyr_component_main_start.
+struct fyr_scheduler_t {
+    // Returns the running coroutine without acquiring a reference
+    struct fyr_coro_t* (*running)(void);
+    void (*yield)(bool wait);
+    void (*resume)(struct fyr_coro_t *coro);
+};
+
+extern struct fyr_scheduler_t fyr_scheduler;
+
+// Called by the scheduler if no coroutine is ready, e.g. to wait for I/O events.
+// The poller resumes the coroutines whose events have occurred. With `block` set it may wait for events.
+// Returns false if it is not waiting for any event. Then the waiting coroutines can only be resumed by other coroutines.
+extern bool (*fyr_poller)(bool block);
+
+// Saves the callee-saved registers on the current stack, stores the stack pointer in *from
+// and continues the context saved in `to`.
+void fyr_context_switch(void **from, void *to);
+// Prepares the stack ending at `top` such that switching to the returned stack pointer calls entry(arg).
+// `entry` must not return.
+void* fyr_context_init(void *top, void (*entry)(void*), void *arg);
+
+#endif
@@ -0,0 +1,88 @@
+// Measures the per-operation cost of the runtime functions which the C backend calls for
+// reference counting, locks, null checks and lengths.
+//
+// Build and run from the repository root, once calling the functions in fyr.o and once using the
+// inline fast paths of fyr_inline.h, as generated code does:
+//   gcc -O3 -Isrc/runtime -o /tmp/calls test/bench/inline.c src/runtime/fyr.c && /tmp/calls
+//   gcc -O3 -DFYR_BENCH_INLINE -Isrc/runtime -o /tmp/inline test/bench/inline.c src/runtime/fyr.c && /tmp/inline
+// Compile fyr.c separately (as fyr.o) to measure without any cross-file inlining by gcc.
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef FYR_BENCH_INLINE
+#include "fyr_inline.h"
+#else
+#include "fyr.h"
+#endif
+
+#define ROUNDS 100000000
+#define COUNT 64
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keeps the compiler from merging or removing operations on 'ptr'
+#define BARRIER(ptr) __asm__ volatile("" : : "r"(ptr) : "memory")
+
+static void report(const char* name, double start) {
+    printf("%-16s %.2f ns\n", name, (now() - start) * 1e9 / ROUNDS);
+}
+
+int main() {
+    addr_t obj = fyr_alloc(16);
+    addr_t arr = fyr_alloc_arr(COUNT, 4);
+    addr_t null = NULL;
+    int_t sum = 0;
+
+    double start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        fyr_incref(obj);
+        BARRIER(obj);
+        fyr_decref(obj, NULL);
+    }
+    report("incref/decref", start);
+
+    start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        fyr_lock(obj);
+        BARRIER(obj);
+        fyr_unlock(obj, NULL);
+    }
+    report("lock/unlock", start);
+
+    start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        fyr_notnull_ref(obj);
+        BARRIER(obj);
+    }
+    report("notnull_ref", start);
+
+    start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        sum += fyr_cmp_ref(obj, null);
+        BARRIER(null);
+    }
+    report("cmp_ref", start);
+
+    start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        sum += fyr_len_arr(arr);
+        BARRIER(arr);
+    }
+    report("len_arr", start);
+
+    start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        sum = fyr_min(sum, i) + fyr_max(sum, i);
+        BARRIER(sum);
+    }
+    report("min+max", start);
+
+    fyr_free(obj, NULL);
+    fyr_free_arr(arr, NULL);
+    return sum == 42;
+}
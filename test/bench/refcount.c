@@ -0,0 +1,131 @@
+// Measures reference counting by the owner thread and checks objects shared with other threads.
+//
+// Build and run from the repository root, once with and once without biased reference counting:
+//   gcc -O3 -pthread -Isrc/runtime -o /tmp/refcount test/bench/refcount.c src/runtime/fyr.c && /tmp/refcount
+//   gcc -O3 -pthread -DFYR_BIASED_RC -Isrc/runtime -o /tmp/refcount_brc test/bench/refcount.c src/runtime/fyr.c && /tmp/refcount_brc
+// Adding -DFYR_MEM_LIBC -fsanitize=address reports leaks and double frees.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "fyr.h"
+
+#define ROUNDS 100000000
+#define OBJECTS 100000
+#define THREADS 4
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int destructed;
+
+static void dtr(addr_t ptr) {
+    __atomic_add_fetch(&destructed, 1, __ATOMIC_RELAXED);
+}
+
+static addr_t objects[OBJECTS];
+
+#ifdef FYR_BIASED_RC
+static pthread_barrier_t barrier;
+
+// Takes a reference to every object and releases it after the owner has freed the objects
+static void* take_refs(void* arg) {
+    for(int i = 0; i < OBJECTS; i++) {
+        fyr_incref(objects[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    for(int i = 0; i < OBJECTS; i++) {
+        fyr_decref(objects[i], dtr);
+    }
+    return NULL;
+}
+
+// Releases references which have been counted by the owner
+static void* release_refs(void* arg) {
+    for(int i = 0; i < OBJECTS; i++) {
+        fyr_decref(objects[i], dtr);
+    }
+    return NULL;
+}
+
+static void check(int expected) {
+    if (destructed != expected) {
+        printf("FAILED: %d destructors ran, expected %d\n", destructed, expected);
+        exit(1);
+    }
+}
+
+static void shared(void) {
+    pthread_t threads[THREADS];
+
+    // Other threads hold references while the owner frees the objects
+    destructed = 0;
+    pthread_barrier_init(&barrier, NULL, THREADS + 1);
+    for(int i = 0; i < OBJECTS; i++) {
+        objects[i] = fyr_alloc(16);
+    }
+    for(int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, take_refs, NULL);
+    }
+    for(int i = 0; i < OBJECTS; i++) {
+        // The owner takes references, too
+        fyr_incref(objects[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    for(int i = 0; i < OBJECTS; i++) {
+        fyr_free(objects[i], dtr);
+        fyr_decref(objects[i], dtr);
+    }
+    for(int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+    check(OBJECTS);
+
+    // The owner takes references, other threads release them.
+    // The owning pointer is frozen, i.e. the last reference runs the destructor.
+    destructed = 0;
+    for(int i = 0; i < OBJECTS; i++) {
+        objects[i] = fyr_alloc(16);
+        for(int t = 0; t < THREADS; t++) {
+            fyr_incref(objects[i]);
+        }
+        fyr_decref(objects[i], dtr);
+    }
+    for(int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, release_refs, NULL);
+    }
+    for(int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    check(0);
+    // The owner applies the released references
+    fyr_brc_drain();
+    check(OBJECTS);
+    printf("shared objects ok\n");
+}
+#endif
+
+int main() {
+    addr_t obj = fyr_alloc(16);
+    double start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        fyr_incref(obj);
+        // Keep the compiler from merging the increments and decrements
+        __asm__ volatile("" : : "r"(obj) : "memory");
+        fyr_decref(obj, NULL);
+    }
+    double t = now() - start;
+    printf("incref/decref by the owner: %.2f ns\n", t * 1e9 / ROUNDS);
+    fyr_free(obj, NULL);
+
+#ifdef FYR_BIASED_RC
+    shared();
+#endif
+    return 0;
+}
@@ -0,0 +1,158 @@
+// Measures string allocation in a tokenizer, which copies every word of a text into a new string.
+// Most words are short. The generated code used to allocate strings with fyr_alloc_arr, which zeroes
+// the memory before it is overwritten by memcpy. fyr_alloc_str only writes the trailing zero.
+// Then the tokens are compared with keywords, once with memcmp as before and once interned with fyr_eq_str.
+//
+// Build and run from the repository root:
+//   gcc -O3 -Isrc/runtime -o /tmp/string test/bench/string.c src/runtime/fyr.c && /tmp/string
+// Adding -DFYR_MEM_LIBC -fsanitize=address reports leaks and double frees.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fyr_inline.h"
+
+#define TEXT_SIZE (1024 * 1024)
+#define ROUNDS 50
+// Number of tokens that are alive at the same time
+#define WINDOW 256
+
+static const char* words[] = {"a", "of", "the", "fyr", "token", "string", "compiler", "allocation", "reference", "counting", "x", "if", "return", "incremental", "unsafe_pointer"};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* generate_text(void) {
+    char* text = malloc(TEXT_SIZE + 1);
+    int pos = 0;
+    srand(42);
+    while (1) {
+        const char* w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+        int l = strlen(w);
+        if (pos + l + 1 > TEXT_SIZE) {
+            break;
+        }
+        memcpy(text + pos, w, l);
+        pos += l;
+        text[pos++] = ' ';
+    }
+    text[pos] = 0;
+    return text;
+}
+
+static int_t tokenize(const char* text, bool use_str, int_t* count) {
+    addr_t window[WINDOW] = {0};
+    int_t sum = 0;
+    int_t n = 0;
+    const char* p = text;
+    while (*p) {
+        const char* start = p;
+        while (*p && *p != ' ') {
+            p++;
+        }
+        int_t len = p - start;
+        addr_t s;
+        if (use_str) {
+            s = fyr_alloc_str(len);
+        } else {
+            s = fyr_alloc_arr(len + 1, 1);
+        }
+        memcpy(s, start, len);
+        sum += s[0] + fyr_len_str(s);
+        addr_t* slot = &window[n++ % WINDOW];
+        fyr_free_arr(*slot, NULL);
+        *slot = s;
+        if (*p) {
+            p++;
+        }
+    }
+    for (int i = 0; i < WINDOW; i++) {
+        fyr_free_arr(window[i], NULL);
+    }
+    *count += n;
+    return sum;
+}
+
+static void run(const char* name, const char* text, bool use_str) {
+    int_t count = 0;
+    int_t sum = 0;
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        sum += tokenize(text, use_str, &count);
+    }
+    printf("%-16s %.2f ns/token (checksum %ld)\n", name, (now() - start) * 1e9 / count, (long)sum);
+}
+
+// Counts the tokens which are equal to one of the keywords, as a lexer would do.
+static void compare(const char* name, addr_t* tokens, int_t count, addr_t* keywords, int_t kwcount, bool use_eq) {
+    int_t sum = 0;
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int_t i = 0; i < count; i++) {
+            for (int_t k = 0; k < kwcount; k++) {
+                if (use_eq) {
+                    sum += fyr_eq_str(tokens[i], keywords[k]);
+                } else {
+                    // The code which the compiler used to generate for ==
+                    int_t l = fyr_min(fyr_len_arr(tokens[i]), fyr_len_arr(keywords[k]));
+                    sum += memcmp(tokens[i], keywords[k], l) == 0;
+                }
+            }
+        }
+    }
+    printf("%-16s %.2f ns/comparison (checksum %ld)\n", name, (now() - start) * 1e9 / ((double)ROUNDS * count * kwcount), (long)sum);
+}
+
+static addr_t new_str(const char* s, int_t len) {
+    addr_t str = fyr_alloc_str(len);
+    memcpy(str, s, len);
+    return str;
+}
+
+int main() {
+    char* text = generate_text();
+    // Warm up the free lists of the allocator
+    tokenize(text, false, &(int_t){0});
+    run("fyr_alloc_arr", text, false);
+    run("fyr_alloc_str", text, true);
+
+    int_t count = 1024;
+    int_t kwcount = 4;
+    addr_t tokens[1024];
+    addr_t interned[1024];
+    addr_t keywords[4];
+    addr_t kwinterned[4];
+    const char* p = text;
+    for (int_t i = 0; i < count; i++) {
+        const char* start = p;
+        while (*p != ' ') {
+            p++;
+        }
+        tokens[i] = new_str(start, p - start);
+        interned[i] = fyr_intern_str(tokens[i]);
+        p++;
+    }
+    const char* kw[] = {"if", "return", "the", "string"};
+    for (int_t k = 0; k < kwcount; k++) {
+        keywords[k] = new_str(kw[k], strlen(kw[k]));
+        kwinterned[k] = fyr_intern_str(keywords[k]);
+    }
+    compare("memcmp", tokens, count, keywords, kwcount, false);
+    compare("fyr_eq_str", tokens, count, keywords, kwcount, true);
+    compare("interned", interned, count, kwinterned, kwcount, true);
+    for (int_t i = 0; i < count; i++) {
+        fyr_decref_arr(tokens[i], NULL);
+        fyr_decref_arr(interned[i], NULL);
+    }
+    for (int_t k = 0; k < kwcount; k++) {
+        fyr_decref_arr(keywords[k], NULL);
+        fyr_decref_arr(kwinterned[k], NULL);
+    }
+    free(text);
+    return 0;
+}
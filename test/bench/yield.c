@@ -0,0 +1,118 @@
+// Measures the round-trip latency of switching between two coroutines.
+//
+// It compares the setjmp/longjmp switch used by earlier versions of the runtime with
+// fyr_context_switch and with a complete fyr_yield(false) round-trip through the scheduler.
+//
+// Build and run from the repository root:
+//   gcc -O3 -U_FORTIFY_SOURCE -Isrc/runtime -o /tmp/yield test/bench/yield.c src/runtime/fyr.c src/runtime/fyr_spawn.c && /tmp/yield
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <alloca.h>
+#include <time.h>
+
+#include "fyr.h"
+#include "fyr_spawn.h"
+
+#define ROUNDS 10000000
+#define STACKSIZE (64*1024)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double start) {
+    double t = now() - start;
+    printf("%-24s %8.1f ns per round-trip\n", name, t * 1e9 / ROUNDS);
+}
+
+// setjmp/longjmp
+
+static jmp_buf sj_main;
+static jmp_buf sj_coro;
+
+static __attribute__((noinline)) void sj_run(__attribute__((unused)) void *dummy) {
+    if (!setjmp(sj_coro)) {
+        longjmp(sj_main, 1);
+    }
+    for(;;) {
+        if (!setjmp(sj_coro)) {
+            longjmp(sj_main, 1);
+        }
+    }
+}
+
+// Launches sj_run on a heap stack the way the generated spawn functions used to do it.
+static __attribute__((noinline)) void sj_start(void) {
+    uint8_t *p = malloc(STACKSIZE);
+    uint8_t *newtop = p + STACKSIZE;
+    uint8_t *mytop = (uint8_t*)&p;
+    void *dummy = alloca((size_t)((intptr_t)mytop - (intptr_t)newtop));
+    if (setjmp(sj_main)) {
+        return;
+    }
+    sj_run(dummy);
+}
+
+static void bench_setjmp(void) {
+    sj_start();
+    double start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        if (!setjmp(sj_main)) {
+            longjmp(sj_coro, 1);
+        }
+    }
+    report("setjmp/longjmp", start);
+}
+
+// fyr_context_switch
+
+static void *cs_main;
+static void *cs_coro;
+
+static void cs_run(__attribute__((unused)) void *arg) {
+    for(;;) {
+        fyr_context_switch(&cs_coro, cs_main);
+    }
+}
+
+static void bench_context_switch(void) {
+    uint8_t *stack = malloc(STACKSIZE);
+    cs_coro = fyr_context_init(stack + STACKSIZE, cs_run, NULL);
+    double start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        fyr_context_switch(&cs_main, cs_coro);
+    }
+    report("fyr_context_switch", start);
+}
+
+// fyr_yield
+
+static void yield_run(__attribute__((unused)) struct fyr_coro_t *c) {
+    for(int i = 0; i < ROUNDS; i++) {
+        fyr_yield(false);
+    }
+    fyr_exit();
+}
+
+static void bench_yield(void) {
+    fyr_component_main_start();
+    fyr_spawn(fyr_coro_new(yield_run, 0, 0));
+    double start = now();
+    for(int i = 0; i < ROUNDS; i++) {
+        fyr_yield(false);
+    }
+    report("fyr_yield", start);
+    fyr_component_main_end();
+}
+
+int main() {
+    bench_setjmp();
+    bench_context_switch();
+    bench_yield();
+    return 0;
+}
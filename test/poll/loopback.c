@@ -0,0 +1,172 @@
+// Exercises the event loop of src/poll with a loopback TCP connection.
+//
+// A server coroutine accepts connections and echoes every message, while a number of client coroutines
+// connect, send and wait for the echo. A further coroutine checks that timers fire while all others wait for I/O.
+// Exits with 0 on success.
+//
+// Build and run from the repository root:
+//   gcc -O2 -Isrc/runtime -Isrc/poll -o /tmp/loopback test/poll/loopback.c src/poll/fyr_poll.c src/runtime/fyr.c src/runtime/fyr_spawn.c && /tmp/loopback
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "fyr.h"
+#include "fyr_spawn.h"
+#include "fyr_poll.h"
+
+#define CLIENTS 100
+#define MESSAGES 10
+
+static int port;
+static int echoed;
+static int ticks;
+static int failures;
+
+static void fail(const char *msg) {
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    __atomic_add_fetch(&failures, 1, __ATOMIC_SEQ_CST);
+}
+
+static int nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Reads exactly `len` bytes
+static bool recv_all(int fd, char *buf, int len) {
+    int done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n > 0) {
+            done += n;
+        } else if (n < 0 && errno == EAGAIN) {
+            if (fyr_poll_fd(fd, FYR_POLL_IN, 5000) <= 0) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void connection(struct fyr_coro_t *c) {
+    int fd = *(int*)(c + 1);
+    char buf[16];
+    for(int i = 0; i < MESSAGES; i++) {
+        if (!recv_all(fd, buf, sizeof(buf))) {
+            fail("server read");
+            break;
+        }
+        // The messages are small. Hence, the socket buffer never fills up.
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            fail("server write");
+            break;
+        }
+    }
+    close(fd);
+    fyr_exit();
+}
+
+static void server(struct fyr_coro_t *c) {
+    int lfd = *(int*)(c + 1);
+    for(int accepted = 0; accepted < CLIENTS; ) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EAGAIN && fyr_poll_fd(lfd, FYR_POLL_IN, 5000) > 0) {
+                continue;
+            }
+            fail("accept");
+            break;
+        }
+        struct fyr_coro_t *conn = fyr_coro_new(connection, sizeof(int), 0);
+        *(int*)(conn + 1) = nonblocking(fd);
+        fyr_spawn(conn);
+        accepted++;
+    }
+    close(lfd);
+    fyr_exit();
+}
+
+static void client(struct fyr_coro_t *c) {
+    int id = *(int*)(c + 1);
+    int fd = nonblocking(socket(AF_INET, SOCK_STREAM, 0));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (errno != EINPROGRESS || fyr_poll_fd(fd, FYR_POLL_OUT, 5000) != FYR_POLL_OUT) {
+            fail("connect");
+            close(fd);
+            fyr_exit();
+        }
+    }
+    char out[16], in[16];
+    for(int i = 0; i < MESSAGES; i++) {
+        snprintf(out, sizeof(out), "%07d:%07d", id, i);
+        if (write(fd, out, sizeof(out)) != sizeof(out) || !recv_all(fd, in, sizeof(in)) || memcmp(in, out, sizeof(in)) != 0) {
+            fail("client echo");
+            break;
+        }
+        __atomic_add_fetch(&echoed, 1, __ATOMIC_SEQ_CST);
+    }
+    close(fd);
+    fyr_exit();
+}
+
+static void timer(struct fyr_coro_t *c) {
+    (void)c;
+    for(int i = 0; i < 5; i++) {
+        fyr_poll_sleep(10);
+        ticks++;
+    }
+    fyr_exit();
+}
+
+int main() {
+    int lfd = nonblocking(socket(AF_INET, SOCK_STREAM, 0));
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, CLIENTS) != 0 || getsockname(lfd, (struct sockaddr*)&addr, &len) != 0) {
+        perror("listen");
+        return 1;
+    }
+    port = ntohs(addr.sin_port);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fyr_component_main_start();
+    struct fyr_coro_t *s = fyr_coro_new(server, sizeof(int), 0);
+    *(int*)(s + 1) = lfd;
+    fyr_spawn(s);
+    fyr_spawn(fyr_coro_new(timer, 0, 0));
+    for(int i = 0; i < CLIENTS; i++) {
+        struct fyr_coro_t *cl = fyr_coro_new(client, sizeof(int), 0);
+        *(int*)(cl + 1) = i;
+        fyr_spawn(cl);
+    }
+    // The main coroutine sleeps as well, i.e. it must be resumed by the event loop
+    fyr_poll_sleep(20);
+    fyr_component_main_end();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("echoed %d of %d messages, %d ticks, %.1f ms\n", echoed, CLIENTS * MESSAGES, ticks, ms);
+    if (failures != 0 || echoed != CLIENTS * MESSAGES || ticks != 5 || ms < 50) {
+        return 1;
+    }
+    return 0;
+}
@@ -12,7 +12,11 @@ COMPILE_FILES=(
     "src/collections/tree"
     "src/collections/list"
     "src/strconv"
+    "src/intern"
+    "src/poll"
     "src/examples/mandelbrot"
+    "src/examples/biasedrc"
+    "src/examples/interning"
 )
 
 # these files should fail to compile
@@ -23,6 +27,8 @@ COMPILE_FILES_NEGATIVE=(
 RUN_FILES=(
     "list"
     "tree"
+    "biasedrc"
+    "interning"
 )
 
 # only run these tests if we explicitly tell it to
@@ -91,13 +97,29 @@ run_files_valgrind() {
         printf "\nUnable to check for memory leaks. Please install valgrind.\n"
         return
     fi
+    # The size-class allocator of fyr.o hides leaks from valgrind.
+    # Link the executables against the runtime built with -DFYR_MEM_LIBC, which uses calloc and free.
+    cd $DIR
+    npm run build:lib:valgrind >/dev/null 2>&1
+    cd - >/dev/null
     for file in "${RUN_FILES[@]}"; do
         printf "%s: Checking %s for memory leaks...\n" `date +%F_%T` $file
-        eval "valgrind --leak-check=yes -q $DIR/bin/$ARCH/$file" >/dev/null 2>&1
+        local src=""
+        for c in "${COMPILE_FILES[@]}"; do
+            if [ "$(basename $c)" == "$file" ]; then
+                src=$c
+            fi
+        done
+        # Linking always happens, even if the packages are up to date
+        $DIR/bin/fyrc -n "$DIR/$src" >/dev/null 2>&1 && eval "valgrind --leak-check=yes --error-exitcode=1 -q $DIR/bin/$ARCH/$file" >/dev/null 2>&1
         if [ $? -ne 0 ]; then
             RUN_LEAKS="$RUN_LEAKS $file"
         fi
     done
+    # Restore the runtime used by all other builds
+    cd $DIR
+    npm run build:lib >/dev/null 2>&1
+    cd - >/dev/null
 }
 
 # --------- output a summary -------------------------------------------------